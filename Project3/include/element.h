@@ -1,7 +1,11 @@
 #ifndef ELEMENT_H
 #define ELEMENT_H
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "ray_stats.h"
 
 // Vec3 类
 template<typename T>
@@ -28,6 +32,9 @@ public:
     T dot(const Vec3 &v) const {
         return x * v.x + y * v.y + z * v.z;
     }
+    Vec3 cross(const Vec3 &v) const {
+        return Vec3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+    }
     T length2() const {
         return x * x + y * y + z * z;
     }
@@ -57,6 +64,12 @@ public:
 typedef Vec3<float> Vec3f;
 
 
+// 材质：字段含义与 Sphere 中的同名字段相同
+struct Material {
+    Vec3f surfaceColor, emissionColor;
+    float transparency = 0, reflectivity = 0;
+};
+
 // Sphere 类
 class Sphere
 {
@@ -77,9 +90,14 @@ public:
         emissionColor(ec), transparency(transp), reflectivity(refl) 
     {}
 
+    Material material() const {
+        return Material{surfaceColor, emissionColor, transparency, reflectivity};
+    }
+
     // 射线与球体求交逻辑
     // rayorig：光源方向；raydir：光线方向单位向量；t0、t1：返回交点
     bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t0, float &t1) const{
+    RAY_STAT(prims, 1);
     Vec3f l = center - rayorig; // 光源到球心的连线
     float tca = l.dot(raydir); // 投影长度
     if (tca < 0) return false; // 球在射线后方
@@ -96,4 +114,83 @@ public:
 };
 
 
+// 三角形：三个顶点及顶点法线(按重心坐标插值得到平滑着色的法线)，同一网格的三角形共享材质
+struct Triangle {
+    Vec3f v0, v1, v2;
+    Vec3f n0, n1, n2;
+    uint32_t material = 0;  // 在 TriangleMesh::materials 中的下标
+};
+
+// 场景中所有网格的三角形及其材质
+struct TriangleMesh {
+    std::vector<Triangle> triangles;
+    std::vector<Material> materials;
+};
+
+// 仿射变换：3x4 矩阵，最后一列为平移
+struct Transform {
+    float m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+    Vec3f point(const Vec3f &p) const {
+        return Vec3f(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                     m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                     m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+    Vec3f vector(const Vec3f &v) const {
+        return Vec3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                     m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                     m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+    // 按线性部分的转置变换：法线需要用逆矩阵的转置，因此对逆变换调用它
+    Vec3f transposed(const Vec3f &v) const {
+        return Vec3f(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+                     m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                     m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+    }
+
+    Transform inverse() const {
+        const float (&a)[4] = m[0], (&b)[4] = m[1], (&c)[4] = m[2];
+        float det = a[0] * (b[1] * c[2] - b[2] * c[1]) - a[1] * (b[0] * c[2] - b[2] * c[0]) + a[2] * (b[0] * c[1] - b[1] * c[0]);
+        float inv = 1 / det;
+        Transform r;
+        r.m[0][0] = (b[1] * c[2] - b[2] * c[1]) * inv, r.m[0][1] = (a[2] * c[1] - a[1] * c[2]) * inv, r.m[0][2] = (a[1] * b[2] - a[2] * b[1]) * inv;
+        r.m[1][0] = (b[2] * c[0] - b[0] * c[2]) * inv, r.m[1][1] = (a[0] * c[2] - a[2] * c[0]) * inv, r.m[1][2] = (a[2] * b[0] - a[0] * b[2]) * inv;
+        r.m[2][0] = (b[0] * c[1] - b[1] * c[0]) * inv, r.m[2][1] = (a[1] * c[0] - a[0] * c[1]) * inv, r.m[2][2] = (a[0] * b[1] - a[1] * b[0]) * inv;
+        Vec3f t = -r.vector(Vec3f(a[3], b[3], c[3]));
+        r.m[0][3] = t.x, r.m[1][3] = t.y, r.m[2][3] = t.z;
+        return r;
+    }
+
+    // 先均匀缩放 scale 倍，再绕 y 轴旋转 yaw 度，最后平移到 offset
+    static Transform place(const Vec3f &offset, float scale, float yaw) {
+        float c = std::cos(yaw * float(M_PI) / 180) * scale, s = std::sin(yaw * float(M_PI) / 180) * scale;
+        Transform r;
+        r.m[0][0] = c, r.m[0][2] = s, r.m[0][3] = offset.x;
+        r.m[1][1] = scale, r.m[1][3] = offset.y;
+        r.m[2][0] = -s, r.m[2][2] = c, r.m[2][3] = offset.z;
+        return r;
+    }
+};
+
+// 可被多次放置的物体：物体空间中的球体与网格
+// lods[k] 是网格第 k+1 级的简化版本(球体不简化，各级共用)
+struct Prototype {
+    std::string name;
+    std::vector<Sphere> spheres;
+    TriangleMesh mesh;
+    std::vector<TriangleMesh> lods;
+};
+
+// 原型的一次放置：物体空间到世界空间的变换
+struct Instance {
+    uint32_t prototype;
+    Transform toWorld;
+};
+
+// 场景中的所有原型及其实例
+struct InstanceSet {
+    std::vector<Prototype> prototypes;
+    std::vector<Instance> instances;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef IMAGE_SINK_H
+#define IMAGE_SINK_H
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "element.h"
+
+// 分带图像输出接口
+// 渲染器按自上而下的顺序逐条推送行带(band)，输出端无需持有整幅图像，
+// 因此任意分辨率下的峰值内存只与一个行带的大小相关
+class ImageSink
+{
+public:
+    virtual ~ImageSink() {}
+    virtual bool begin(unsigned width, unsigned height) = 0;
+    // rows：rowCount 行像素，行主序、自上而下，第一行是图像的第 y0 行
+    virtual bool writeBand(unsigned y0, unsigned rowCount, const Vec3f* rows) = 0;
+    virtual bool end() = 0;
+};
+
+// 流式 PNG 编码器
+// 每行按 stb_image_write 的启发式选择滤波，整幅图像是一个 zlib(deflate) 流，
+// 每个行带送入压缩器后把已产生的压缩数据写成一个 IDAT 块，整个过程只缓存一个行带与 zlib 的窗口
+// 任何一步失败时关闭并删除不完整的文件
+class PngStreamWriter : public ImageSink
+{
+public:
+    explicit PngStreamWriter(std::string filename);
+    ~PngStreamWriter();
+
+    bool begin(unsigned width, unsigned height) override;
+    bool writeBand(unsigned y0, unsigned rowCount, const Vec3f* rows) override;
+    bool end() override;
+
+private:
+    struct Deflater; // zlib 的压缩流，定义在 image_sink.cpp 中，使用者不需要包含 zlib.h
+
+    std::string filename;
+    FILE* file = nullptr;
+    std::unique_ptr<Deflater> deflater; // begin 成功后非空，end 中释放
+    unsigned width = 0, height = 0, rowsWritten = 0;
+    std::vector<unsigned char> raw;      // 当前行带滤波后的数据，每行以滤波类型字节开头
+    std::vector<unsigned char> prevRow;  // 上一行的 RGB 数据(滤波的参照)
+    std::vector<unsigned char> curRow;   // 当前行的 RGB 数据
+    std::vector<unsigned char> filtered; // 尝试某种滤波时的临时结果
+    std::vector<unsigned char> chunk;    // 当前 IDAT 块的数据
+
+    bool writeChunk(const char type[4], const unsigned char* data, size_t size);
+    void filterRow(unsigned char* out);
+    bool deflateChunk(const unsigned char* data, size_t size, int flush);
+    bool discard();
+};
+
+// float 颜色分量转换为 8 位，超出 [0, 1] 的部分截断
+inline unsigned char to_byte(float c) {
+    return (unsigned char)(std::max(0.0f, std::min(1.0f, c)) * 255);
+}
+
+#endif
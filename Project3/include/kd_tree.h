@@ -1,10 +1,24 @@
 #ifndef KD_TREE_H
 #define KD_TREE_H
 #include "./element.h"
+#include <cstdint>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <algorithm>
+#include "./thread_pool.h"
+#include "./timeline.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define MAX_KD_TREE_DEPTH 20
+// 叶子的图元数上限(LinearKDNode::count 为 16 位)：超过最大深度的节点仍多于此数时继续按中位数对半划分，
+// 2^30 个图元最多再划分 15 层，遍历栈(KD_TRAVERSAL_STACK_SIZE)足够
+#define KD_MAX_LEAF_PRIMS 0xFFFFu
+// 叶子中一组 SoA 球体的数量，对应一次 SSE 求交
+#define SPHERE_BLOCK_SIZE 4
 
 // 轴向包围盒
 class AABB
@@ -25,8 +39,21 @@ public:
         max.z = std::max(max.z, other.max.z);
     }
 
+    // 扩展盒子以包含一个点
+    void expand(const Vec3f& p) {
+        expand(AABB(p, p));
+    }
+
+    // 表面积，用于 SAH 代价估计；空盒子返回 0
+    float surfaceArea() const {
+        Vec3f d = max - min;
+        if (d.x < 0 || d.y < 0 || d.z < 0) return 0;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
     // Slab法相交检测
     bool intersect(const Vec3f& rayorig, const Vec3f& raydir, float& t_enter, float& t_exit) const {
+        RAY_STAT(boxes, 1);
         float tmin = -INFINITY, tmax = INFINITY;
 
         // 分别检查 X, Y, Z 三个slab
@@ -61,6 +88,13 @@ public:
 inline AABB get_Sphere_AABB(const Sphere &s){
     return AABB(s.center - Vec3f(s.radius), s.center + Vec3f(s.radius));
 }
+// 获取三角形的 AABB
+inline AABB triangle_box(const Triangle &t){
+    AABB box(t.v0, t.v0);
+    box.expand(t.v1);
+    box.expand(t.v2);
+    return box;
+}
 
 
 struct KDNode {
@@ -69,6 +103,7 @@ struct KDNode {
     KDNode *right = nullptr;
     std::vector<const Sphere*> objects;
     bool isLeaf = false;
+    int axis = 0; // 内部节点的划分轴 (0=x, 1=y, 2=z)
 
     ~KDNode() {
         delete left;
@@ -84,8 +119,8 @@ static KDNode* build_kd_tree(std::vector<const Sphere*>& objs, int depth) {
         node->bbox.expand(get_Sphere_AABB(*s));
     }
 
-    // 终止条件：如果物体很少，或超过最大深度，直接作为叶子节点
-    if (objs.size() <= 2 || depth > MAX_KD_TREE_DEPTH) {
+    // 终止条件：如果物体很少，或超过最大深度(且不超过叶子的图元数上限)，直接作为叶子节点
+    if (objs.size() <= 2 || (depth > MAX_KD_TREE_DEPTH && objs.size() <= KD_MAX_LEAF_PRIMS)) {
         node->isLeaf = true;
         node->objects = objs;
         return node;
@@ -93,6 +128,7 @@ static KDNode* build_kd_tree(std::vector<const Sphere*>& objs, int depth) {
 
     // 选择分割轴 (按深度循环选择 X, Y, Z)
     int axis = depth % 3;
+    node->axis = axis;
 
     // 按球体中心在所选轴上的位置排序
     std::sort(objs.begin(), objs.end(), [axis](const Sphere* a, const Sphere* b) {
@@ -114,6 +150,193 @@ static KDNode* build_kd_tree(std::vector<const Sphere*>& objs, int depth) {
 }
 
 
+// 取向量在指定轴上的分量
+inline float axis_value(const Vec3f& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// 包围盒最长的轴
+inline int longest_axis(const AABB& box) {
+    Vec3f d = box.max - box.min;
+    return d.x >= d.y && d.x >= d.z ? 0 : (d.y >= d.z ? 1 : 2);
+}
+
+// 分箱 SAH 构建参数
+// 节点代价 = traversalCost + (A_L * B(N_L) + A_R * B(N_R)) / A * intersectCost，
+// 叶子代价 = B(N) * intersectCost，两者比较决定是否继续划分；
+// B(N) = ceil(N / blockSize) 为叶子中需要测试的球体组数
+struct SAHParams {
+    float traversalCost = 1.0f;  // 访问一个内部节点(两次 AABB 测试)的代价
+    float intersectCost = 1.0f;  // 与一组球体求交的代价
+    int bins = 16;               // 每个轴上的分箱数(并行构建最多 SAH_MAX_BINS 个)
+    int maxLeafSize = 8;         // 超过该数量的叶子即使代价更高也会被强制划分
+    int blockSize = SPHERE_BLOCK_SIZE; // 叶子一次求交的球体数，1 表示逐个求交
+
+    float leafCost(size_t n) const {
+        size_t b = std::max(1, blockSize);
+        // 构建时每个节点要调用上百次，组大小是 2 的幂时用移位代替 64 位除法
+        size_t groups = (b & (b - 1)) == 0 ? (n + b - 1) >> __builtin_ctzll(b) : (n + b - 1) / b;
+        return float(groups) * intersectCost;
+    }
+};
+
+// 分箱 SAH 构建：在三个轴上把球心分入等宽箱子，扫描所有箱子边界，
+// 选择表面积启发代价最小的划分；划分不如直接做叶子划算时停止
+inline KDNode* build_sah_tree(std::vector<const Sphere*>& objs, const SAHParams& params, int depth = 0) {
+    KDNode* node = new KDNode();
+    AABB centroidBox;
+    for (const auto* s : objs) {
+        node->bbox.expand(get_Sphere_AABB(*s));
+        centroidBox.expand(s->center);
+    }
+
+    size_t n = objs.size();
+    float leafCost = params.leafCost(n);
+    if (n <= 1 || (depth > MAX_KD_TREE_DEPTH && n <= KD_MAX_LEAF_PRIMS)) {
+        node->isLeaf = true;
+        node->objects = objs;
+        return node;
+    }
+    // 超过最大深度但物体数超出叶子上限：沿球心包围盒的最长轴按中位数对半划分
+    if (depth > MAX_KD_TREE_DEPTH) {
+        int axis = longest_axis(centroidBox);
+        std::nth_element(objs.begin(), objs.begin() + n / 2, objs.end(), [axis](const Sphere* a, const Sphere* b) {
+            return axis_value(a->center, axis) < axis_value(b->center, axis);
+        });
+        std::vector<const Sphere*> left_objs(objs.begin(), objs.begin() + n / 2);
+        std::vector<const Sphere*> right_objs(objs.begin() + n / 2, objs.end());
+        node->axis = axis;
+        node->left = build_sah_tree(left_objs, params, depth + 1);
+        node->right = build_sah_tree(right_objs, params, depth + 1);
+        return node;
+    }
+
+    struct Bin {
+        AABB box;
+        size_t count = 0;
+    };
+    const int B = std::max(2, params.bins);
+    std::vector<Bin> bins(B);
+    std::vector<float> rightArea(B);
+    std::vector<size_t> rightCount(B);
+    float parentArea = node->bbox.surfaceArea();
+    float bestCost = INFINITY;
+    int bestAxis = -1, bestSplit = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float cmin = axis_value(centroidBox.min, axis), cmax = axis_value(centroidBox.max, axis);
+        if (cmax - cmin <= 0) continue; // 球心在该轴上重合，无法划分
+        float scale = B / (cmax - cmin);
+
+        std::fill(bins.begin(), bins.end(), Bin());
+        for (const auto* s : objs) {
+            int b = std::min(B - 1, int((axis_value(s->center, axis) - cmin) * scale));
+            bins[b].box.expand(get_Sphere_AABB(*s));
+            bins[b].count++;
+        }
+
+        // 从右向左累计，得到每个边界右侧的包围盒面积与数量
+        AABB acc;
+        size_t cnt = 0;
+        for (int i = B - 1; i > 0; --i) {
+            acc.expand(bins[i].box);
+            cnt += bins[i].count;
+            rightArea[i] = acc.surfaceArea();
+            rightCount[i] = cnt;
+        }
+        // 从左向右扫描，边界 i 左侧为箱子 [0, i)
+        acc = AABB();
+        cnt = 0;
+        for (int i = 1; i < B; ++i) {
+            acc.expand(bins[i - 1].box);
+            cnt += bins[i - 1].count;
+            if (cnt == 0 || rightCount[i] == 0) continue;
+            float cost = params.traversalCost + (acc.surfaceArea() * params.leafCost(cnt) + rightArea[i] * params.leafCost(rightCount[i])) / parentArea;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // 找不到有效划分，或划分代价不低于叶子代价且物体足够少，则作为叶子
+    bool small = (int)n <= params.maxLeafSize && n <= KD_MAX_LEAF_PRIMS;
+    if ((bestAxis < 0 && small) || (bestCost >= leafCost && small)) {
+        node->isLeaf = true;
+        node->objects = objs;
+        return node;
+    }
+
+    // 球心完全重合而物体又很多时，按数量对半划分，保证叶子规模有上限
+    if (bestAxis < 0) {
+        std::vector<const Sphere*> left_objs(objs.begin(), objs.begin() + n / 2);
+        std::vector<const Sphere*> right_objs(objs.begin() + n / 2, objs.end());
+        node->left = build_sah_tree(left_objs, params, depth + 1);
+        node->right = build_sah_tree(right_objs, params, depth + 1);
+        return node;
+    }
+
+    float cmin = axis_value(centroidBox.min, bestAxis);
+    float scale = B / (axis_value(centroidBox.max, bestAxis) - cmin);
+    auto mid = std::partition(objs.begin(), objs.end(), [&](const Sphere* s) {
+        return std::min(B - 1, int((axis_value(s->center, bestAxis) - cmin) * scale)) < bestSplit;
+    });
+    std::vector<const Sphere*> left_objs(objs.begin(), mid);
+    std::vector<const Sphere*> right_objs(mid, objs.end());
+
+    node->axis = bestAxis;
+    node->left = build_sah_tree(left_objs, params, depth + 1);
+    node->right = build_sah_tree(right_objs, params, depth + 1);
+    return node;
+}
+
+// 树的统计信息
+struct TreeStats {
+    size_t nodes = 0, leaves = 0, objects = 0;
+    int maxDepth = 0;
+    float sahCost = 0; // 按根节点面积归一化的期望遍历代价
+};
+
+// 递归计算 SAH 代价：叶子为 B(N) * intersectCost，
+// 内部节点为 traversalCost + Σ(子节点面积 / 节点面积) * 子节点代价
+inline float kd_tree_sah_cost(const KDNode* node, const SAHParams& params) {
+    if (node->isLeaf) return params.leafCost(node->objects.size());
+    float area = node->bbox.surfaceArea();
+    if (area <= 0) return params.traversalCost;
+    return params.traversalCost
+        + node->left->bbox.surfaceArea() / area * kd_tree_sah_cost(node->left, params)
+        + node->right->bbox.surfaceArea() / area * kd_tree_sah_cost(node->right, params);
+}
+
+inline void collect_tree_stats(const KDNode* node, int depth, TreeStats& stats) {
+    stats.nodes++;
+    stats.maxDepth = std::max(stats.maxDepth, depth);
+    if (node->isLeaf) {
+        stats.leaves++;
+        stats.objects += node->objects.size();
+        return;
+    }
+    collect_tree_stats(node->left, depth + 1, stats);
+    collect_tree_stats(node->right, depth + 1, stats);
+}
+
+inline TreeStats kd_tree_stats(const KDNode* root, const SAHParams& params = SAHParams()) {
+    TreeStats stats;
+    if (!root) return stats;
+    collect_tree_stats(root, 0, stats);
+    stats.sahCost = kd_tree_sah_cost(root, params);
+    return stats;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const TreeStats& stats) {
+    os << "nodes=" << stats.nodes << " leaves=" << stats.leaves
+       << " depth=" << stats.maxDepth << " avgLeaf=" << (stats.leaves ? float(stats.objects) / stats.leaves : 0)
+       << " SAH=" << stats.sahCost;
+    return os;
+}
+
+
 static const Sphere* intersect_kd_tree(KDNode* node, const Vec3f& rayorig, const Vec3f& raydir, float& tnear) {
     if (!node) return nullptr;
 
@@ -123,6 +346,7 @@ static const Sphere* intersect_kd_tree(KDNode* node, const Vec3f& rayorig, const
         return nullptr;
     }
 
+    RAY_STAT(nodes, 1);
     // 如果是叶子节点，遍历其中的球体
     if (node->isLeaf) {
         const Sphere* hitObj = nullptr;
@@ -139,12 +363,1177 @@ static const Sphere* intersect_kd_tree(KDNode* node, const Vec3f& rayorig, const
         return hitObj;
     }
 
-    // 如果是内部节点，递归遍历子节点
-    const Sphere* hitLeft = intersect_kd_tree(node->left, rayorig, raydir, tnear);
-    const Sphere* hitRight = intersect_kd_tree(node->right, rayorig, raydir, tnear);
+    // 如果是内部节点，按光线在划分轴上的方向先访问近处的子节点，
+    // 近处命中后 tnear 变小，远处子节点往往在包围盒测试时就被剔除
+    KDNode* nearChild = node->left;
+    KDNode* farChild = node->right;
+    if (axis_value(raydir, node->axis) < 0) std::swap(nearChild, farChild);
+    const Sphere* hitNear = intersect_kd_tree(nearChild, rayorig, raydir, tnear);
+    const Sphere* hitFar = intersect_kd_tree(farChild, rayorig, raydir, tnear);
+
+    // tnear 只会在找到更近的交点时更新，因此后返回的非空结果一定更近
+    return hitFar ? hitFar : hitNear;
+}
+
+// 线性化的树节点，固定 32 字节，一条 64 字节缓存行恰好容纳两个节点
+// 节点按深度优先顺序存放：左子节点紧随父节点，右子节点下标记录在 offset 中
+struct LinearKDNode {
+    AABB bbox;
+    uint32_t offset = 0;  // 内部节点：右子节点下标；叶子：在 primIndices(三角形叶子为 triIndices，实例叶子为 instIndices)中的起始位置
+    uint16_t count = 0;   // 叶子中的物体数，0 表示内部节点
+    uint8_t axis = 0;     // 内部节点的划分轴；叶子的图元类型(LEAF_SPHERES / LEAF_TRIANGLES / LEAF_INSTANCES)
+    uint8_t pad = 0;
+};
+
+// 叶子只包含一种图元
+#define LEAF_SPHERES 0
+#define LEAF_TRIANGLES 1
+#define LEAF_INSTANCES 2
+
+// 叶子几何的 SoA 存储：每组 SPHERE_BLOCK_SIZE 个球体的球心与半径平方，恰好一条 64 字节缓存行
+// 遍历叶子时只读取这些数据，颜色、透明度等材质只在确定最近交点后才通过下标访问
+struct alignas(16) SphereBlock {
+    float cx[SPHERE_BLOCK_SIZE], cy[SPHERE_BLOCK_SIZE], cz[SPHERE_BLOCK_SIZE];
+    float r2[SPHERE_BLOCK_SIZE]; // 空位为 -INFINITY，永远不会命中
+};
+
+// 三角形叶子的 SoA 存储：v[k][axis][lane] 为该组第 lane 个三角形第 k 个顶点在 axis 轴上的坐标
+// 空位的坐标为 NaN，求交时所有比较都不成立，永远不会命中
+struct alignas(16) TriangleBlock {
+    float v[3][3][SPHERE_BLOCK_SIZE];
+};
+
+// 紧凑存储的加速树：所有节点位于一段连续数组，叶子共享同一个球体下标数组
+// 每个叶子在 primIndices 中的起点按 SPHERE_BLOCK_SIZE 对齐，blocks[i] 对应
+// primIndices[i * SPHERE_BLOCK_SIZE, (i + 1) * SPHERE_BLOCK_SIZE) 这一组球体的几何数据
+// 三角形叶子以同样的方式使用 triIndices 与 triBlocks，只有球体的场景中两者为空
+// 实例叶子只有 instIndices(不分组)，光线进入实例后在它的底层树中继续遍历
+// 重建时只清空不释放，节点、下标与几何数组的容量作为内存池在多次构建之间复用
+struct TreeInstance;
+
+struct LinearKDTree {
+    std::vector<LinearKDNode> nodes;
+    std::vector<uint32_t> primIndices;
+    std::vector<SphereBlock> blocks;
+    std::vector<uint32_t> triIndices;
+    std::vector<TriangleBlock> triBlocks;
+    std::vector<uint32_t> instIndices;
+    const Sphere* spheres = nullptr; // 球体数组首地址，primIndices 中的下标相对于它
+    uint32_t sphereCount = 0;
+    const TriangleMesh* mesh = nullptr; // 三角形与材质，triIndices 中的下标相对于 mesh->triangles
+    std::vector<TreeInstance>* instances = nullptr; // instIndices 中的下标相对于它；选择细节层次时会修改
+    // 光源列表：构建时收集所有自发光球体，着色时无需再遍历整个场景
+    std::vector<uint32_t> emitters;
+    std::vector<float> emitterCdf;   // 按光源功率累加的分布函数，最后一项为总功率
+    float builtCost = 0;             // 构建完成时的 linear_tree_quality，重新拟合后与之比较以决定是否重建
+
+    void clear() {
+        nodes.clear();
+        primIndices.clear();
+        blocks.clear();
+        triIndices.clear();
+        triBlocks.clear();
+        instIndices.clear();
+        emitters.clear();
+        emitterCdf.clear();
+        spheres = nullptr;
+        sphereCount = 0;
+        mesh = nullptr;
+        instances = nullptr;
+    }
+
+    uint32_t triangleCount() const { return mesh ? (uint32_t)mesh->triangles.size() : 0; }
+
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(LinearKDNode) + primIndices.capacity() * sizeof(uint32_t)
+            + blocks.capacity() * sizeof(SphereBlock)
+            + triIndices.capacity() * sizeof(uint32_t) + triBlocks.capacity() * sizeof(TriangleBlock)
+            + instIndices.capacity() * sizeof(uint32_t)
+            + emitters.capacity() * sizeof(uint32_t) + emitterCdf.capacity() * sizeof(float);
+    }
+
+    // 按功率选择光源：u ∈ [0, 1)，返回 emitters 中的位置并给出选中概率
+    size_t sampleEmitter(float u, float& pdf) const {
+        float total = emitterCdf.back();
+        size_t k = std::upper_bound(emitterCdf.begin(), emitterCdf.end(), u * total) - emitterCdf.begin();
+        k = std::min(k, emitterCdf.size() - 1);
+        pdf = (emitterCdf[k] - (k > 0 ? emitterCdf[k - 1] : 0.0f)) / total;
+        return k;
+    }
+
+    // 将第 slot 个下标位置的球体几何写入对应的 SoA 组
+    void setBlockSphere(size_t slot, const Sphere& s) {
+        SphereBlock& b = blocks[slot / SPHERE_BLOCK_SIZE];
+        size_t lane = slot % SPHERE_BLOCK_SIZE;
+        b.cx[lane] = s.center.x, b.cy[lane] = s.center.y, b.cz[lane] = s.center.z;
+        b.r2[lane] = s.radius2;
+    }
+
+    void setBlockTriangle(size_t slot, const Triangle& tri) {
+        TriangleBlock& b = triBlocks[slot / SPHERE_BLOCK_SIZE];
+        size_t lane = slot % SPHERE_BLOCK_SIZE;
+        const Vec3f* v[3] = {&tri.v0, &tri.v1, &tri.v2};
+        for (int k = 0; k < 3; ++k) {
+            b.v[k][0][lane] = v[k]->x, b.v[k][1][lane] = v[k]->y, b.v[k][2][lane] = v[k]->z;
+        }
+    }
+};
+
+// 顶层树中的实例：底层树(物体空间)、双向变换与世界空间包围盒
+// 底层树按原型各建一棵，所有实例共享，内存只随原型数增长
+// 有细节层次的原型每级一棵底层树，object 指向本帧选中的一级
+struct TreeInstance {
+    const LinearKDTree* object = nullptr;
+    const LinearKDTree* levels = nullptr; // levels[0] 为原网格，之后逐级简化
+    uint32_t levelCount = 1, level = 0;
+    bool levelChanged = false;  // 最近一次选择时切换了层次
+    Transform toWorld, toObject;
+    AABB bounds;                // 所有层次包围盒的并集，切换层次时顶层树不需要重建
+    bool viewDependent = false; // 含有反射或透明的图元
+};
+
+// levels 指向连续存放的 levelCount 棵底层树
+inline TreeInstance make_instance(const LinearKDTree* levels, uint32_t levelCount, const Transform& toWorld) {
+    const LinearKDTree& object = levels[0];
+    TreeInstance inst;
+    inst.object = inst.levels = levels;
+    inst.levelCount = levelCount;
+    inst.toWorld = toWorld;
+    inst.toObject = toWorld.inverse();
+    for (uint32_t l = 0; l < levelCount; ++l) {
+        if (levels[l].nodes.empty()) continue;
+        const AABB& box = levels[l].nodes[0].bbox;
+        for (int k = 0; k < 8; ++k) {
+            inst.bounds.expand(toWorld.point(Vec3f(k & 1 ? box.max.x : box.min.x, k & 2 ? box.max.y : box.min.y, k & 4 ? box.max.z : box.min.z)));
+        }
+    }
+    for (uint32_t i = 0; i < object.sphereCount; ++i) {
+        inst.viewDependent |= object.spheres[i].reflectivity > 0 || object.spheres[i].transparency > 0;
+    }
+    if (object.mesh) {
+        for (const Material& m : object.mesh->materials) inst.viewDependent |= m.reflectivity > 0 || m.transparency > 0;
+    }
+    return inst;
+}
+
+// 最近交点：sphere 与 triangle 至多一个非空，三角形另给出第二、三个顶点的重心坐标
+// 命中实例时 instance 非空，sphere / triangle 指向其原型中的图元(物体空间)
+struct PrimHit {
+    const Sphere* sphere = nullptr;
+    const Triangle* triangle = nullptr;
+    float u = 0, v = 0;
+    const TreeInstance* instance = nullptr;
+
+    explicit operator bool() const { return sphere || triangle; }
+};
+
+// 物体编号：球体为其下标，三角形排在所有球体之后，实例排在所有三角形之后(整个实例共用一个编号)，-1 表示未命中
+inline int32_t hit_object(const LinearKDTree& tree, const PrimHit& hit) {
+    if (hit.instance) return int32_t(tree.sphereCount + tree.triangleCount() + (hit.instance - tree.instances->data()));
+    if (hit.sphere) return int32_t(hit.sphere - tree.spheres);
+    if (hit.triangle) return int32_t(tree.sphereCount + (hit.triangle - tree.mesh->triangles.data()));
+    return -1;
+}
+
+// 命中实例时图元在原型底层树中的编号，其余情况与 hit_object 相同
+inline int32_t hit_primitive(const LinearKDTree& tree, const PrimHit& hit) {
+    if (!hit.instance) return hit_object(tree, hit);
+    PrimHit local = hit;
+    local.instance = nullptr;
+    return hit_object(*hit.instance->object, local);
+}
+
+// 由 hit_object 与 hit_primitive 的编号还原交点
+inline PrimHit object_hit(const LinearKDTree& tree, int32_t object, float u = 0, float v = 0, int32_t primitive = -1) {
+    PrimHit hit;
+    if (object < 0) return hit;
+    uint32_t firstInstance = tree.sphereCount + tree.triangleCount();
+    if (uint32_t(object) >= firstInstance) {
+        const TreeInstance& inst = (*tree.instances)[object - firstInstance];
+        hit = object_hit(*inst.object, primitive, u, v);
+        hit.instance = &inst;
+        return hit;
+    }
+    if (uint32_t(object) < tree.sphereCount) hit.sphere = tree.spheres + object;
+    else hit.triangle = &tree.mesh->triangles[object - tree.sphereCount];
+    hit.u = u, hit.v = v;
+    return hit;
+}
+
+// 物体的材质是否与视角相关(反射或透明)；实例只要含有这样的图元即视为相关
+inline bool object_view_dependent(const LinearKDTree& tree, int32_t object) {
+    uint32_t firstInstance = tree.sphereCount + tree.triangleCount();
+    if (uint32_t(object) >= firstInstance) return (*tree.instances)[object - firstInstance].viewDependent;
+    Material m = uint32_t(object) < tree.sphereCount ? tree.spheres[object].material()
+                                                     : tree.mesh->materials[tree.mesh->triangles[object - tree.sphereCount].material];
+    return m.reflectivity > 0 || m.transparency > 0;
+}
+
+// 物体是否为最近一次选择细节层次时切换了层次的实例(几何形状已经变化)
+inline bool object_level_changed(const LinearKDTree& tree, int32_t object) {
+    uint32_t firstInstance = tree.sphereCount + tree.triangleCount();
+    return uint32_t(object) >= firstInstance && (*tree.instances)[object - firstInstance].levelChanged;
+}
+
+// 交点处的几何法线(未按光线方向翻转)与材质
+// 实例在物体空间中计算，法线再按逆变换的转置变回世界空间
+inline void hit_surface(const LinearKDTree& tree, const PrimHit& hit, const Vec3f& phit, Vec3f& normal, Material& material) {
+    if (hit.instance) {
+        PrimHit local = hit;
+        local.instance = nullptr;
+        hit_surface(*hit.instance->object, local, hit.instance->toObject.point(phit), normal, material);
+        normal = hit.instance->toObject.transposed(normal);
+    } else if (hit.sphere) {
+        normal = phit - hit.sphere->center;
+        material = hit.sphere->material();
+    } else {
+        const Triangle& tri = *hit.triangle;
+        normal = tri.n0 * (1 - hit.u - hit.v) + tri.n1 * hit.u + tri.n2 * hit.v;
+        material = tree.mesh->materials[tri.material];
+    }
+    normal.normalize();
+}
+
+inline uint32_t flatten_node(const KDNode* node, const Sphere* base, LinearKDTree& out) {
+    if (node->isLeaf && node->objects.size() > KD_MAX_LEAF_PRIMS) {
+        // 叶子的图元数超过 16 位计数的上限(其他方式构建的树)：按中位数拆成子树后再展开
+        std::vector<const Sphere*> objs = node->objects;
+        std::unique_ptr<KDNode> split(build_kd_tree(objs, MAX_KD_TREE_DEPTH + 1));
+        return flatten_node(split.get(), base, out);
+    }
+    uint32_t index = (uint32_t)out.nodes.size();
+    out.nodes.emplace_back();
+    out.nodes[index].bbox = node->bbox;
+    if (node->isLeaf) {
+        size_t first = out.primIndices.size();
+        size_t padded = (node->objects.size() + SPHERE_BLOCK_SIZE - 1) / SPHERE_BLOCK_SIZE * SPHERE_BLOCK_SIZE;
+        out.nodes[index].offset = (uint32_t)first;
+        out.nodes[index].count = (uint16_t)node->objects.size();
+        out.primIndices.resize(first + padded, UINT32_MAX);
+        out.blocks.resize((first + padded) / SPHERE_BLOCK_SIZE, SphereBlock{{0}, {0}, {0}, {-INFINITY, -INFINITY, -INFINITY, -INFINITY}});
+        for (size_t i = 0; i < node->objects.size(); ++i) {
+            out.primIndices[first + i] = (uint32_t)(node->objects[i] - base);
+            out.setBlockSphere(first + i, *node->objects[i]);
+        }
+        return index;
+    }
+    out.nodes[index].axis = (uint8_t)node->axis;
+    flatten_node(node->left, base, out);
+    uint32_t right = flatten_node(node->right, base, out);
+    out.nodes[index].offset = right; // emplace_back 可能使引用失效，因此通过下标写回
+    return index;
+}
+
+// 一条光线与一组 SoA 球体求交，逐通道的运算与 Sphere::intersect 相同
+// 返回命中通道的位掩码，t 中写入各命中通道的交点距离(t0 < 0 时为 t1)
+inline int sphere_block_hits(const SphereBlock& b, const Vec3f& rayorig, const Vec3f& raydir, float t[SPHERE_BLOCK_SIZE]) {
+    RAY_STAT(prims, SPHERE_BLOCK_SIZE);
+    RAY_STAT_FETCH(&b, sizeof(b));
+    int mask = 0;
+#if defined(__SSE2__) && SPHERE_BLOCK_SIZE == 4
+    __m128 zero = _mm_setzero_ps();
+    __m128 dx = _mm_set1_ps(raydir.x), dy = _mm_set1_ps(raydir.y), dz = _mm_set1_ps(raydir.z);
+    __m128 lx = _mm_sub_ps(_mm_load_ps(b.cx), _mm_set1_ps(rayorig.x));
+    __m128 ly = _mm_sub_ps(_mm_load_ps(b.cy), _mm_set1_ps(rayorig.y));
+    __m128 lz = _mm_sub_ps(_mm_load_ps(b.cz), _mm_set1_ps(rayorig.z));
+    __m128 tca = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, dx), _mm_mul_ps(ly, dy)), _mm_mul_ps(lz, dz));
+    __m128 ll = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+    __m128 d2 = _mm_sub_ps(ll, _mm_mul_ps(tca, tca));
+    __m128 r2 = _mm_load_ps(b.r2);
+    mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(tca, zero), _mm_cmple_ps(d2, r2)));
+    if (mask == 0) return 0;
+    __m128 thc = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(r2, d2), zero));
+    __m128 t0 = _mm_sub_ps(tca, thc), t1 = _mm_add_ps(tca, thc);
+    __m128 behind = _mm_cmplt_ps(t0, zero); // t0 < 0 时使用 t1
+    _mm_storeu_ps(t, _mm_or_ps(_mm_and_ps(behind, t1), _mm_andnot_ps(behind, t0)));
+#else
+    for (int i = 0; i < SPHERE_BLOCK_SIZE; ++i) {
+        float lx = b.cx[i] - rayorig.x, ly = b.cy[i] - rayorig.y, lz = b.cz[i] - rayorig.z;
+        float tca = lx * raydir.x + ly * raydir.y + lz * raydir.z;
+        float d2 = lx * lx + ly * ly + lz * lz - tca * tca;
+        if (tca < 0 || d2 > b.r2[i]) continue;
+        float thc = std::sqrt(b.r2[i] - d2);
+        t[i] = tca - thc < 0 ? tca + thc : tca - thc;
+        mask |= 1 << i;
+    }
+#endif
+    return mask;
+}
+
+// 返回比 tnear 更近的最近通道(同距离取靠前者)并更新 tnear，没有则返回 -1
+inline int intersect_sphere_block(const SphereBlock& b, const Vec3f& rayorig, const Vec3f& raydir, float& tnear) {
+    float t[SPHERE_BLOCK_SIZE];
+    int mask = sphere_block_hits(b, rayorig, raydir, t);
+    int best = -1;
+    for (int i = 0; i < SPHERE_BLOCK_SIZE; ++i) {
+        if ((mask >> i & 1) && t[i] < tnear) {
+            tnear = t[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+// 水密(watertight)光线-三角形求交的逐光线预处理 (Woop, Benthin, Wald 2013)
+// 取方向分量绝对值最大的轴为 kz，重排坐标轴并做剪切变换使光线方向变为 +z，
+// 此后每条边的边函数只取决于它的两个端点：相邻三角形共享的边对同一条光线给出完全相同的结果，
+// 光线不会从网格的缝隙中漏过，也不会在共享边上被重复计算
+struct WatertightRay {
+    Vec3f orig;
+    int kx, ky, kz;
+    float sx, sy, sz;
+
+    WatertightRay(const Vec3f& o, const Vec3f& d) : orig(o) {
+        float ax = std::abs(d.x), ay = std::abs(d.y), az = std::abs(d.z);
+        kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        float dz = axis_value(d, kz);
+        if (dz < 0) std::swap(kx, ky); // 保持三角形的环绕方向
+        sx = axis_value(d, kx) / dz;
+        sy = axis_value(d, ky) / dz;
+        sz = 1 / dz;
+    }
+};
+
+// 单精度边函数恰好为 0(光线穿过边或顶点)时改用双精度重新计算
+inline void watertight_edges_double(const float px[3], const float py[3], float& u, float& v, float& w) {
+    u = float(double(px[2]) * py[1] - double(py[2]) * px[1]);
+    v = float(double(px[0]) * py[2] - double(py[0]) * px[2]);
+    w = float(double(px[1]) * py[0] - double(py[1]) * px[0]);
+}
+
+// 一条光线与一组 SoA 三角形求交(双面)，返回命中通道的位掩码
+// t 为交点距离，u、v 为第二、三个顶点的重心坐标
+inline int triangle_block_hits(const TriangleBlock& b, const WatertightRay& r, float t[SPHERE_BLOCK_SIZE],
+                               float u[SPHERE_BLOCK_SIZE], float v[SPHERE_BLOCK_SIZE]) {
+    RAY_STAT(prims, SPHERE_BLOCK_SIZE);
+    RAY_STAT_FETCH(&b, sizeof(b));
+    const float o[3] = {r.orig.x, r.orig.y, r.orig.z};
+#if defined(__SSE2__) && SPHERE_BLOCK_SIZE == 4
+    __m128 zero = _mm_setzero_ps();
+    __m128 sx = _mm_set1_ps(r.sx), sy = _mm_set1_ps(r.sy), sz = _mm_set1_ps(r.sz);
+    // 三个顶点平移到光线起点并剪切变换后的坐标
+    __m128 px[3], py[3], pz[3];
+    for (int k = 0; k < 3; ++k) {
+        __m128 x = _mm_sub_ps(_mm_load_ps(b.v[k][r.kx]), _mm_set1_ps(o[r.kx]));
+        __m128 y = _mm_sub_ps(_mm_load_ps(b.v[k][r.ky]), _mm_set1_ps(o[r.ky]));
+        __m128 z = _mm_sub_ps(_mm_load_ps(b.v[k][r.kz]), _mm_set1_ps(o[r.kz]));
+        px[k] = _mm_sub_ps(x, _mm_mul_ps(sx, z));
+        py[k] = _mm_sub_ps(y, _mm_mul_ps(sy, z));
+        pz[k] = _mm_mul_ps(sz, z);
+    }
+    // 边函数：U、V、W 分别对应第一、二、三个顶点的(未归一化)重心坐标
+    __m128 U = _mm_sub_ps(_mm_mul_ps(px[2], py[1]), _mm_mul_ps(py[2], px[1]));
+    __m128 V = _mm_sub_ps(_mm_mul_ps(px[0], py[2]), _mm_mul_ps(py[0], px[2]));
+    __m128 W = _mm_sub_ps(_mm_mul_ps(px[1], py[0]), _mm_mul_ps(py[1], px[0]));
+    int exact = _mm_movemask_ps(_mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(U, zero), _mm_cmpeq_ps(V, zero)), _mm_cmpeq_ps(W, zero)));
+    if (exact) {
+        alignas(16) float lx[3][4], ly[3][4], lu[4], lv[4], lw[4];
+        for (int k = 0; k < 3; ++k) _mm_store_ps(lx[k], px[k]), _mm_store_ps(ly[k], py[k]);
+        _mm_store_ps(lu, U), _mm_store_ps(lv, V), _mm_store_ps(lw, W);
+        for (int i = 0; i < 4; ++i) {
+            if (!(exact >> i & 1)) continue;
+            const float ex[3] = {lx[0][i], lx[1][i], lx[2][i]}, ey[3] = {ly[0][i], ly[1][i], ly[2][i]};
+            watertight_edges_double(ex, ey, lu[i], lv[i], lw[i]);
+        }
+        U = _mm_load_ps(lu), V = _mm_load_ps(lv), W = _mm_load_ps(lw);
+    }
+    // 三个边函数异号时光线从三角形外经过
+    __m128 neg = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero), _mm_cmplt_ps(V, zero)), _mm_cmplt_ps(W, zero));
+    __m128 pos = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_cmpgt_ps(V, zero)), _mm_cmpgt_ps(W, zero));
+    __m128 det = _mm_add_ps(_mm_add_ps(U, V), W);
+    __m128 T = _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, pz[0]), _mm_mul_ps(V, pz[1])), _mm_mul_ps(W, pz[2]));
+    __m128 rcp = _mm_div_ps(_mm_set1_ps(1), det);
+    __m128 tt = _mm_mul_ps(T, rcp);
+    __m128 ok = _mm_andnot_ps(_mm_and_ps(neg, pos), _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpgt_ps(tt, zero)));
+    int mask = _mm_movemask_ps(ok);
+    if (mask == 0) return 0;
+    _mm_storeu_ps(t, tt);
+    _mm_storeu_ps(u, _mm_mul_ps(V, rcp));
+    _mm_storeu_ps(v, _mm_mul_ps(W, rcp));
+    return mask;
+#else
+    int mask = 0;
+    for (int i = 0; i < SPHERE_BLOCK_SIZE; ++i) {
+        float px[3], py[3], pz[3];
+        for (int k = 0; k < 3; ++k) {
+            float z = b.v[k][r.kz][i] - o[r.kz];
+            px[k] = b.v[k][r.kx][i] - o[r.kx] - r.sx * z;
+            py[k] = b.v[k][r.ky][i] - o[r.ky] - r.sy * z;
+            pz[k] = r.sz * z;
+        }
+        float U = px[2] * py[1] - py[2] * px[1];
+        float V = px[0] * py[2] - py[0] * px[2];
+        float W = px[1] * py[0] - py[1] * px[0];
+        if (U == 0 || V == 0 || W == 0) watertight_edges_double(px, py, U, V, W);
+        if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0)) continue;
+        float det = U + V + W;
+        if (det == 0) continue;
+        float rcp = 1 / det;
+        float tt = (U * pz[0] + V * pz[1] + W * pz[2]) * rcp;
+        if (!(tt > 0)) continue; // NaN 空位同样被排除
+        t[i] = tt, u[i] = V * rcp, v[i] = W * rcp;
+        mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+// 返回比 tnear 更近的最近通道并更新 tnear 与重心坐标，没有则返回 -1
+inline int intersect_triangle_block(const TriangleBlock& b, const WatertightRay& r, float& tnear, float& u, float& v) {
+    float t[SPHERE_BLOCK_SIZE], bu[SPHERE_BLOCK_SIZE], bv[SPHERE_BLOCK_SIZE];
+    int mask = triangle_block_hits(b, r, t, bu, bv);
+    int best = -1;
+    for (int i = 0; i < SPHERE_BLOCK_SIZE; ++i) {
+        if ((mask >> i & 1) && t[i] < tnear) {
+            tnear = t[i], u = bu[i], v = bv[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+// 收集自发光球体(emissionColor.x > 0，与着色时的判定一致)，功率取发光颜色三个分量之和
+inline void collect_emitters(const std::vector<Sphere>& spheres, LinearKDTree& out) {
+    out.emitters.clear();
+    out.emitterCdf.clear();
+    float total = 0;
+    for (size_t i = 0; i < spheres.size(); ++i) {
+        const Vec3f& e = spheres[i].emissionColor;
+        if (e.x > 0) {
+            total += std::max(0.0f, e.x + e.y + e.z);
+            out.emitters.push_back((uint32_t)i);
+            out.emitterCdf.push_back(total);
+        }
+    }
+}
+
+// 线性树每个节点的 SAH 代价(以该节点自身面积归一化)，定义与 kd_tree_sah_cost 相同
+// 子节点的下标总是大于父节点(左子节点紧随其后，右子节点在左子树之后)，逆序遍历即可先算子节点
+inline void linear_tree_node_costs(const LinearKDTree& tree, const SAHParams& params, std::vector<float>& cost) {
+    cost.resize(tree.nodes.size());
+    for (size_t i = tree.nodes.size(); i-- > 0;) {
+        const LinearKDNode& node = tree.nodes[i];
+        if (node.count > 0) {
+            cost[i] = params.leafCost(node.count);
+            continue;
+        }
+        float area = node.bbox.surfaceArea();
+        cost[i] = params.traversalCost;
+        if (area > 0) {
+            cost[i] += tree.nodes[i + 1].bbox.surfaceArea() / area * cost[i + 1]
+                     + tree.nodes[node.offset].bbox.surfaceArea() / area * cost[node.offset];
+        }
+    }
+}
+
+// 整棵树的 SAH 代价，即根节点的代价
+inline float linear_tree_sah_cost(const LinearKDTree& tree, const SAHParams& params = SAHParams()) {
+    std::vector<float> cost;
+    linear_tree_node_costs(tree, params, cost);
+    return cost.empty() ? 0 : cost[0];
+}
+
+// 重建判据：所有内部节点 SAH 代价的平均值
+// 根节点的代价按根包围盒面积归一化，场景中有巨大的地面球体时几乎不随其余部分变化；
+// 平均值中每棵子树权重相同，任何局部的包围盒膨胀都会体现出来
+inline float linear_tree_quality(const LinearKDTree& tree, const SAHParams& params = SAHParams()) {
+    std::vector<float> cost;
+    linear_tree_node_costs(tree, params, cost);
+    double sum = 0;
+    size_t internal = 0;
+    for (size_t i = 0; i < tree.nodes.size(); ++i) {
+        if (tree.nodes[i].count == 0) sum += cost[i], ++internal;
+    }
+    return internal ? float(sum / internal) : 0;
+}
+
+// 线性树的统计信息，与 kd_tree_stats 对应
+inline TreeStats linear_tree_stats(const LinearKDTree& tree, const SAHParams& params = SAHParams()) {
+    TreeStats stats;
+    std::vector<int> depth(tree.nodes.size());
+    for (size_t i = 0; i < tree.nodes.size(); ++i) {
+        const LinearKDNode& node = tree.nodes[i];
+        stats.nodes++;
+        stats.maxDepth = std::max(stats.maxDepth, depth[i]);
+        if (node.count > 0) {
+            stats.leaves++;
+            stats.objects += node.count;
+        } else {
+            depth[i + 1] = depth[node.offset] = depth[i] + 1;
+        }
+    }
+    stats.sahCost = linear_tree_sah_cost(tree, params);
+    return stats;
+}
+
+// 将指针形式的树压缩为线性布局；out 中原有的容量会被复用
+inline void flatten_kd_tree(const KDNode* root, const std::vector<Sphere>& spheres, LinearKDTree& out) {
+    out.clear();
+    out.spheres = spheres.data();
+    out.sphereCount = (uint32_t)spheres.size();
+    if (root) flatten_node(root, spheres.data(), out);
+    collect_emitters(spheres, out);
+    out.builtCost = linear_tree_quality(out);
+}
+
+// 并行原地构建：结果与 build_sah_tree + flatten_kd_tree 完全相同，但
+//   - 不构建指针树，也不在每层把物体列表复制成左右两个新数组：所有节点共用一个图元数组，
+//     按划分结果用 std::partition 原地重排，节点只记录自己的区间；
+//   - 一次遍历同时完成三个轴的分箱，子节点的包围盒直接由箱子合并得到；
+//   - 物体较多的节点并行分箱，右子树作为线程池任务构建，写入独立的节点片段，
+//     最后按深度优先顺序拼接为线性数组
+#define SAH_MAX_BINS 64
+#define PARALLEL_BUILD_GRAIN 4096     // 物体数不少于此的节点把右子树交给其他线程
+#define PARALLEL_BIN_GRAIN (1 << 16)  // 物体数不少于此的节点按块并行分箱
+
+// 构建期间的图元：包围盒中心与半边长的紧凑副本及其下标
+// 球体的中心为球心、半边长为半径；三角形与实例的下标分别带 TRIANGLE_PRIM_BIT、INSTANCE_PRIM_BIT 标记
+#define TRIANGLE_PRIM_BIT 0x80000000u
+#define INSTANCE_PRIM_BIT 0x40000000u
+#define PRIM_INDEX_MASK 0x3fffffffu
+
+struct BuildPrim {
+    Vec3f center;
+    Vec3f extent;
+    uint32_t index;
+};
+
+struct SAHBin {
+    AABB box;
+    size_t count = 0;
+};
+
+// 三个轴的分箱结果，连续存放 3 x B 个箱子；每个线程复用自己的缓冲区，构建过程中不再分配内存
+struct SAHBinning {
+    std::vector<SAHBin> bins;
+    int B = 0;
+
+    void reset(int binCount) {
+        B = binCount;
+        bins.assign(3 * B, SAHBin());
+    }
+    SAHBin* axis(int a) { return bins.data() + a * B; }
+    const SAHBin* axis(int a) const { return bins.data() + a * B; }
+
+    void merge(const SAHBinning& other) {
+        for (size_t i = 0; i < bins.size(); ++i) {
+            bins[i].box.expand(other.bins[i].box);
+            bins[i].count += other.bins[i].count;
+        }
+    }
+};
+
+// 选出的划分及左右子节点的包围盒
+struct SAHSplit {
+    int axis = -1, bin = 0;
+    float cost = INFINITY;
+    AABB leftBox, rightBox;
+};
+
+class ParallelTreeBuilder
+{
+public:
+    ParallelTreeBuilder(const std::vector<Sphere>& spheres, const TriangleMesh* mesh, std::vector<TreeInstance>* instances,
+                        const SAHParams& params, WorkStealingPool* pool)
+        : spheres(spheres), mesh(mesh && !mesh->triangles.empty() ? mesh : nullptr),
+          instances(instances && !instances->empty() ? instances : nullptr), params(params),
+          pool(pool && pool->size() > 1 ? pool : nullptr), B(std::min(SAH_MAX_BINS, std::max(2, params.bins))) {}
+
+    void build(LinearKDTree& out) {
+        TimelineScope scope("build tree", "build");
+        out.clear();
+        out.spheres = spheres.data();
+        out.sphereCount = (uint32_t)spheres.size();
+        out.mesh = mesh;
+        out.instances = instances;
+        size_t triangleCount = mesh ? mesh->triangles.size() : 0;
+        size_t instanceCount = instances ? instances->size() : 0;
+        mixedTypes = (spheres.size() > 0) + (triangleCount > 0) + (instanceCount > 0) > 1;
+        if (spheres.empty() && triangleCount == 0 && instanceCount == 0) return;
+
+        prims.resize(spheres.size() + triangleCount + instanceCount);
+        AABB bbox;
+        for (size_t i = 0; i < spheres.size(); ++i) {
+            prims[i] = BuildPrim{spheres[i].center, Vec3f(spheres[i].radius), (uint32_t)i};
+            bbox.expand(get_Sphere_AABB(spheres[i]));
+        }
+        BuildPrim* prim = prims.data() + spheres.size();
+        for (size_t t = 0; t < triangleCount; ++t, ++prim) {
+            *prim = box_prim(triangle_box(mesh->triangles[t]), uint32_t(t) | TRIANGLE_PRIM_BIT);
+            bbox.expand(prim_box(*prim));
+        }
+        for (size_t k = 0; k < instanceCount; ++k, ++prim) {
+            *prim = box_prim((*instances)[k].bounds, uint32_t(k) | INSTANCE_PRIM_BIT);
+            bbox.expand(prim_box(*prim));
+        }
+
+        fragments.emplace_back();
+        TaskGroup group;
+        buildNode(0, (uint32_t)prims.size(), bbox, 0, fragments.front(), group);
+        if (pool) pool->wait(group);
+
+        TimelineScope flatten("flatten tree", "build");
+        size_t total = 0;
+        for (const auto& fragment : fragments) total += fragment.size();
+        out.nodes.reserve(total);
+        emitNode(0, 0, out);
+        fillLeaves(out);
+        collect_emitters(spheres, out);
+        out.builtCost = linear_tree_quality(out);
+    }
+
+private:
+    const std::vector<Sphere>& spheres;
+    const TriangleMesh* mesh;
+    std::vector<TreeInstance>* instances;
+    bool mixedTypes = false;
+    const SAHParams& params;
+    WorkStealingPool* pool;
+    const int B;
+    std::vector<BuildPrim> prims;
+    // 节点片段：fragments[0] 从根节点开始；pad = 1 的内部节点 offset 为右子树所在的片段编号
+    std::deque<std::vector<LinearKDNode>> fragments; // deque 追加元素时已有片段的引用不会失效
+    std::mutex fragmentMutex;
+    // 拼接后的叶子：primIndices 中的起点对应 prims 中的起点
+    std::vector<uint32_t> leafNodes, leafSources;
+    uint32_t primCount = 0, triCount = 0, instCount = 0;
+
+    static AABB prim_box(const BuildPrim& p) {
+        return AABB(p.center - p.extent, p.center + p.extent);
+    }
+
+    static BuildPrim box_prim(const AABB& box, uint32_t index) {
+        Vec3f center = (box.min + box.max) * 0.5f;
+        Vec3f lo = center - box.min, hi = box.max - center;
+        // 半边长略微放大，保证 center ± extent 在舍入后仍覆盖原包围盒
+        Vec3f extent = Vec3f(std::max(lo.x, hi.x), std::max(lo.y, hi.y), std::max(lo.z, hi.z)) * (1 + 1e-6f);
+        return BuildPrim{center, extent, index};
+    }
+
+    static uint8_t prim_type(const BuildPrim& p) {
+        return p.index & INSTANCE_PRIM_BIT ? LEAF_INSTANCES : p.index & TRIANGLE_PRIM_BIT ? LEAF_TRIANGLES : LEAF_SPHERES;
+    }
+
+    // 把 [begin, end) 中与第一个图元同类型的图元排在前面，返回分界位置；只有一种图元时返回 end
+    uint32_t partitionTypes(uint32_t begin, uint32_t end) {
+        if (!mixedTypes) return end;
+        uint8_t type = prim_type(prims[begin]);
+        return uint32_t(std::partition(prims.begin() + begin, prims.begin() + end, [type](const BuildPrim& p) {
+            return prim_type(p) == type;
+        }) - prims.begin());
+    }
+
+    void binRange(uint32_t begin, uint32_t end, const AABB& centroid, SAHBinning& out) const {
+        float cmin[3], scale[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            cmin[axis] = axis_value(centroid.min, axis);
+            float extent = axis_value(centroid.max, axis) - cmin[axis];
+            scale[axis] = extent > 0 ? B / extent : 0;
+        }
+        const BuildPrim* data = prims.data();
+        SAHBin* bins[3] = {out.axis(0), out.axis(1), out.axis(2)};
+        for (uint32_t i = begin; i < end; ++i) {
+            const BuildPrim& p = data[i];
+            AABB box = prim_box(p);
+            for (int axis = 0; axis < 3; ++axis) {
+                if (scale[axis] == 0) continue;
+                int b = std::min(B - 1, int((axis_value(p.center, axis) - cmin[axis]) * scale[axis]));
+                SAHBin& bin = bins[axis][b];
+                bin.box.expand(box);
+                bin.count++;
+            }
+        }
+    }
+
+    // 与 build_sah_tree 相同的代价扫描，扫描顺序与比较方式一致，因此选出的划分也一致
+    SAHSplit findSplit(uint32_t begin, uint32_t end, const AABB& bbox, const AABB& centroid) const {
+        // 线程局部的缓冲区：parallel_for 等待期间本线程可能执行其他节点的构建任务，
+        // 因此必须在等待结束后再清空并合并
+        static thread_local SAHBinning binning;
+        uint32_t n = end - begin;
+        if (pool && n >= PARALLEL_BIN_GRAIN) {
+            size_t chunks = (n + PARALLEL_BIN_GRAIN - 1) / PARALLEL_BIN_GRAIN;
+            std::vector<SAHBinning> partial(chunks);
+            pool->parallel_for(chunks, [&](size_t c, unsigned) {
+                uint32_t b0 = begin + uint32_t(c * PARALLEL_BIN_GRAIN);
+                partial[c].reset(B);
+                binRange(b0, std::min(end, b0 + PARALLEL_BIN_GRAIN), centroid, partial[c]);
+            });
+            binning.reset(B);
+            for (const auto& part : partial) binning.merge(part);
+        } else {
+            binning.reset(B);
+            binRange(begin, end, centroid, binning);
+        }
+
+        SAHSplit best;
+        float rightArea[SAH_MAX_BINS];
+        size_t rightCount[SAH_MAX_BINS];
+        float parentArea = bbox.surfaceArea();
+        for (int axis = 0; axis < 3; ++axis) {
+            if (axis_value(centroid.max, axis) - axis_value(centroid.min, axis) <= 0) continue;
+            const SAHBin* bins = binning.axis(axis);
+            // 空箱子不改变累计的包围盒与数量：右侧面积沿用上一个边界的值，
+            // 左侧跳过空箱子之后的边界，其代价与前一个边界相同，严格小于的比较不会选中它
+            AABB acc;
+            size_t cnt = 0;
+            float area = 0;
+            for (int i = B - 1; i > 0; --i) {
+                if (bins[i].count > 0) {
+                    acc.expand(bins[i].box);
+                    cnt += bins[i].count;
+                    area = acc.surfaceArea();
+                }
+                rightArea[i] = area;
+                rightCount[i] = cnt;
+            }
+            acc = AABB();
+            cnt = 0;
+            for (int i = 1; i < B; ++i) {
+                if (bins[i - 1].count == 0) continue;
+                acc.expand(bins[i - 1].box);
+                cnt += bins[i - 1].count;
+                if (rightCount[i] == 0) break;
+                float cost = params.traversalCost + (acc.surfaceArea() * params.leafCost(cnt) + rightArea[i] * params.leafCost(rightCount[i])) / parentArea;
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = i;
+                }
+            }
+        }
+        if (best.axis >= 0) {
+            const SAHBin* bins = binning.axis(best.axis);
+            for (int i = 0; i < B; ++i) {
+                AABB& box = i < best.bin ? best.leftBox : best.rightBox;
+                box.expand(bins[i].box);
+            }
+        }
+        return best;
+    }
+
+    AABB rangeBox(uint32_t begin, uint32_t end) const {
+        AABB bbox;
+        for (uint32_t i = begin; i < end; ++i) bbox.expand(prim_box(prims[i]));
+        return bbox;
+    }
+
+    AABB rangeCentroids(uint32_t begin, uint32_t end) const {
+        AABB centroid;
+        for (uint32_t i = begin; i < end; ++i) centroid.expand(prims[i].center);
+        return centroid;
+    }
+
+    // 构建 [begin, end) 对应的子树，节点按深度优先顺序追加到 nodes，返回子树根的下标
+    uint32_t buildNode(uint32_t begin, uint32_t end, const AABB& bbox, int depth,
+                       std::vector<LinearKDNode>& nodes, TaskGroup& group) {
+        uint32_t index = (uint32_t)nodes.size();
+        nodes.emplace_back();
+        nodes[index].bbox = bbox;
+        uint32_t n = end - begin;
+        bool leaf = n <= 1 || (depth > MAX_KD_TREE_DEPTH && n <= KD_MAX_LEAF_PRIMS);
+        bool median = !leaf && depth > MAX_KD_TREE_DEPTH;
+        AABB centroid;
+        SAHSplit split;
+        if (!leaf) {
+            centroid = rangeCentroids(begin, end);
+        }
+        if (!leaf && !median) {
+            split = findSplit(begin, end, bbox, centroid);
+            leaf = (int)n <= params.maxLeafSize && n <= KD_MAX_LEAF_PRIMS && (split.axis < 0 || split.cost >= params.leafCost(n));
+        }
+
+        uint32_t mid;
+        if (median) {
+            // 超过最大深度但图元数超出叶子上限：沿中心包围盒的最长轴按中位数对半划分，与 build_sah_tree 相同
+            int axis = longest_axis(centroid);
+            mid = begin + n / 2;
+            std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end, [axis](const BuildPrim& a, const BuildPrim& b) {
+                return axis_value(a.center, axis) < axis_value(b.center, axis);
+            });
+            split.leftBox = rangeBox(begin, mid);
+            split.rightBox = rangeBox(mid, end);
+            nodes[index].axis = (uint8_t)axis;
+        } else if (leaf) {
+            mid = partitionTypes(begin, end);
+            if (mid == end) {
+                nodes[index].offset = begin;
+                nodes[index].count = (uint16_t)n;
+                nodes[index].axis = n > 0 ? prim_type(prims[begin]) : LEAF_SPHERES;
+                return index;
+            }
+            // 不同类型的图元混在一起时按类型划分，每个叶子只包含一种图元
+            split.leftBox = rangeBox(begin, mid);
+            split.rightBox = rangeBox(mid, end);
+        } else if (split.axis < 0) {
+            // 球心完全重合而物体又很多时，按数量对半划分
+            mid = begin + n / 2;
+            split.leftBox = rangeBox(begin, mid);
+            split.rightBox = rangeBox(mid, end);
+        } else {
+            int axis = split.axis;
+            float cmin = axis_value(centroid.min, axis);
+            float scale = B / (axis_value(centroid.max, axis) - cmin);
+            mid = uint32_t(std::partition(prims.begin() + begin, prims.begin() + end, [&](const BuildPrim& p) {
+                return std::min(B - 1, int((axis_value(p.center, axis) - cmin) * scale)) < split.bin;
+            }) - prims.begin());
+            nodes[index].axis = (uint8_t)axis;
+        }
 
-    if (hitRight) return hitRight; // 右子树最后更新了 tnear，说明找到了更近的物品，返回它
-    return hitLeft;
+        if (pool && n >= PARALLEL_BUILD_GRAIN) {
+            // 右子树写入新的片段并交给线程池，当前线程继续构建左子树
+            std::vector<LinearKDNode>* fragment;
+            uint32_t fragmentIndex;
+            {
+                std::lock_guard<std::mutex> lock(fragmentMutex);
+                fragmentIndex = (uint32_t)fragments.size();
+                fragments.emplace_back();
+                fragment = &fragments.back();
+            }
+            pool->run(group, [this, mid, end, split, depth, fragment, &group] {
+                TimelineScope scope("build subtree", "build", "prims", end - mid);
+                buildNode(mid, end, split.rightBox, depth + 1, *fragment, group);
+            });
+            buildNode(begin, mid, split.leftBox, depth + 1, nodes, group);
+            nodes[index].offset = fragmentIndex;
+            nodes[index].pad = 1;
+        } else {
+            buildNode(begin, mid, split.leftBox, depth + 1, nodes, group);
+            uint32_t right = buildNode(mid, end, split.rightBox, depth + 1, nodes, group);
+            nodes[index].offset = right;
+        }
+        return index;
+    }
+
+    // 按深度优先顺序把片段拼接到 out.nodes，叶子在 primIndices 中的起点按 SPHERE_BLOCK_SIZE 对齐
+    uint32_t emitNode(uint32_t fragmentIndex, uint32_t local, LinearKDTree& out) {
+        const LinearKDNode& node = fragments[fragmentIndex][local];
+        uint32_t index = (uint32_t)out.nodes.size();
+        out.nodes.push_back(node);
+        out.nodes[index].pad = 0;
+        if (node.count > 0) {
+            leafNodes.push_back(index);
+            leafSources.push_back(node.offset);
+            if (node.axis == LEAF_INSTANCES) {
+                // 实例逐个进入底层树，不需要分组对齐
+                out.nodes[index].offset = instCount;
+                instCount += node.count;
+                return index;
+            }
+            uint32_t& count = node.axis == LEAF_TRIANGLES ? triCount : primCount;
+            out.nodes[index].offset = count;
+            count += (node.count + SPHERE_BLOCK_SIZE - 1) / SPHERE_BLOCK_SIZE * SPHERE_BLOCK_SIZE;
+            return index;
+        }
+        emitNode(fragmentIndex, local + 1, out);
+        uint32_t right = node.pad ? emitNode(node.offset, 0, out) : emitNode(fragmentIndex, node.offset, out);
+        out.nodes[index].offset = right;
+        return index;
+    }
+
+    // 写入叶子的图元下标与 SoA 几何，各叶子互不重叠，按块并行
+    void fillLeaves(LinearKDTree& out) {
+        out.primIndices.resize(primCount, UINT32_MAX);
+        out.blocks.resize(primCount / SPHERE_BLOCK_SIZE, SphereBlock{{0}, {0}, {0}, {-INFINITY, -INFINITY, -INFINITY, -INFINITY}});
+        out.triIndices.resize(triCount, UINT32_MAX);
+        TriangleBlock empty;
+        std::fill(&empty.v[0][0][0], &empty.v[0][0][0] + sizeof(empty.v) / sizeof(float), NAN);
+        out.triBlocks.resize(triCount / SPHERE_BLOCK_SIZE, empty);
+        out.instIndices.resize(instCount);
+        const size_t grain = 4096;
+        auto fill = [&](size_t chunk, unsigned) {
+            size_t last = std::min(leafNodes.size(), (chunk + 1) * grain);
+            for (size_t l = chunk * grain; l < last; ++l) {
+                const LinearKDNode& node = out.nodes[leafNodes[l]];
+                for (uint32_t k = 0; k < node.count; ++k) {
+                    uint32_t prim = prims[leafSources[l] + k].index & PRIM_INDEX_MASK;
+                    if (node.axis == LEAF_INSTANCES) {
+                        out.instIndices[node.offset + k] = prim;
+                    } else if (node.axis == LEAF_TRIANGLES) {
+                        out.triIndices[node.offset + k] = prim;
+                        out.setBlockTriangle(node.offset + k, mesh->triangles[prim]);
+                    } else {
+                        out.primIndices[node.offset + k] = prim;
+                        out.setBlockSphere(node.offset + k, spheres[prim]);
+                    }
+                }
+            }
+        };
+        size_t chunks = (leafNodes.size() + grain - 1) / grain;
+        if (pool) pool->parallel_for(chunks, fill);
+        else for (size_t c = 0; c < chunks; ++c) fill(c, 0);
+    }
+};
+
+// 构建 SAH 树并线性化；pool 非空(且不止一个线程)时并行构建，结果与串行构建逐字节相同
+// mesh 的三角形与 instances 中的实例和球体放进同一棵树；两者可以为空，在树的生命周期内不能移动或修改
+inline void build_linear_tree(const std::vector<Sphere>& spheres, const TriangleMesh* mesh, std::vector<TreeInstance>* instances,
+                              LinearKDTree& out, const SAHParams& params = SAHParams(), WorkStealingPool* pool = nullptr) {
+    ParallelTreeBuilder(spheres, mesh, instances, params, pool).build(out);
+}
+
+inline void build_linear_tree(const std::vector<Sphere>& spheres, LinearKDTree& out, const SAHParams& params = SAHParams(), WorkStealingPool* pool = nullptr) {
+    build_linear_tree(spheres, nullptr, nullptr, out, params, pool);
+}
+
+// 两层结构的底层：每个原型的每一级细节层次在物体空间中构建一棵树，同一原型的各级在 objectTrees 中连续存放，
+// 再为每个实例生成顶层树使用的 TreeInstance；set 与 objectTrees 在 instances 的生命周期内不能修改
+inline void build_instances(const InstanceSet& set, std::vector<LinearKDTree>& objectTrees, std::vector<TreeInstance>& instances,
+                            const SAHParams& params = SAHParams(), WorkStealingPool* pool = nullptr) {
+    TimelineScope scope("build instances", "build");
+    std::vector<size_t> first(set.prototypes.size() + 1, 0);
+    for (size_t i = 0; i < set.prototypes.size(); ++i) first[i + 1] = first[i] + 1 + set.prototypes[i].lods.size();
+    objectTrees.clear();
+    objectTrees.resize(first.back());
+    for (size_t i = 0; i < set.prototypes.size(); ++i) {
+        const Prototype& p = set.prototypes[i];
+        build_linear_tree(p.spheres, &p.mesh, nullptr, objectTrees[first[i]], params, pool);
+        for (size_t l = 0; l < p.lods.size(); ++l) build_linear_tree(p.spheres, &p.lods[l], nullptr, objectTrees[first[i] + 1 + l], params, pool);
+    }
+    instances.clear();
+    for (const Instance& inst : set.instances) {
+        instances.push_back(make_instance(&objectTrees[first[inst.prototype]], uint32_t(first[inst.prototype + 1] - first[inst.prototype]), inst.toWorld));
+    }
+}
+
+// 按相机为每个实例选择细节层次：实例包围球在画面上的直径(像素)大于 pixels / 2 时使用原网格，之后每减半下降一级
+// 每级的三角形约为上一级的 1/4(边长约加倍)，因此三角形在画面上的大小大致不变；pixels 为 0 时全部使用原网格
+// tanHalfFov 为半视场角的正切，height 为图像高度(像素)；返回是否有实例切换了层次
+inline bool select_instance_levels(LinearKDTree& tree, const Vec3f& camPos, float tanHalfFov, unsigned height, float pixels) {
+    if (!tree.instances) return false;
+    bool changed = false;
+    for (TreeInstance& inst : *tree.instances) {
+        uint32_t level = 0;
+        if (pixels > 0 && inst.levelCount > 1) {
+            Vec3f center = (inst.bounds.min + inst.bounds.max) * 0.5f;
+            float radius = (inst.bounds.max - inst.bounds.min).length() * 0.5f;
+            float distance = (center - camPos).length();
+            float size = radius * height / (distance * tanHalfFov);
+            if (distance > radius && size * 2 <= pixels) level = uint32_t(std::min(float(inst.levelCount - 1), std::floor(std::log2(pixels / size))));
+        }
+        inst.levelChanged = level != inst.level;
+        changed |= inst.levelChanged;
+        inst.level = level;
+        inst.object = inst.levels + level;
+    }
+    return changed;
+}
+
+// 球体原地移动(球体数组与拓扑不变)后自底向上重新拟合：更新 SoA 叶子几何，
+// 再逆序遍历节点，叶子取所含图元包围盒的并集，内部节点取两个子节点的并集，整体 O(N)
+// 三角形与实例是静止的，只参与包围盒的合并
+inline void refit_linear_tree(const std::vector<Sphere>& spheres, LinearKDTree& tree) {
+    TimelineScope scope("refit tree", "build");
+    for (size_t slot = 0; slot < tree.primIndices.size(); ++slot) {
+        if (tree.primIndices[slot] != UINT32_MAX) tree.setBlockSphere(slot, spheres[tree.primIndices[slot]]);
+    }
+    for (size_t i = tree.nodes.size(); i-- > 0;) {
+        LinearKDNode& node = tree.nodes[i];
+        AABB box;
+        if (node.count > 0 && node.axis == LEAF_INSTANCES) {
+            for (uint32_t k = 0; k < node.count; ++k) box.expand((*tree.instances)[tree.instIndices[node.offset + k]].bounds);
+        } else if (node.count > 0 && node.axis == LEAF_TRIANGLES) {
+            for (uint32_t k = 0; k < node.count; ++k) box.expand(triangle_box(tree.mesh->triangles[tree.triIndices[node.offset + k]]));
+        } else if (node.count > 0) {
+            for (uint32_t k = 0; k < node.count; ++k) box.expand(get_Sphere_AABB(spheres[tree.primIndices[node.offset + k]]));
+        } else {
+            box = tree.nodes[i + 1].bbox;
+            box.expand(tree.nodes[node.offset].bbox);
+        }
+        node.bbox = box;
+    }
+}
+
+// 动画场景的更新入口：先重新拟合，linear_tree_quality 超过构建时的 rebuildRatio 倍(包围盒重叠过多)再完整重建
+// 返回是否进行了重建
+inline bool update_linear_tree(const std::vector<Sphere>& spheres, LinearKDTree& tree, float rebuildRatio = 1.5f, const SAHParams& params = SAHParams(), WorkStealingPool* pool = nullptr) {
+    if (tree.spheres != spheres.data() || tree.nodes.empty()) {
+        build_linear_tree(spheres, tree.mesh, tree.instances, tree, params, pool);
+        return true;
+    }
+    refit_linear_tree(spheres, tree);
+    if (linear_tree_quality(tree) <= tree.builtCost * rebuildRatio) return false;
+    build_linear_tree(spheres, tree.mesh, tree.instances, tree, params, pool);
+    return true;
+}
+
+// 线性树上的最近交点查询
+// 使用显式栈迭代遍历：内部节点处同时测试两个子节点的包围盒，按光线在划分轴上的方向
+// 先访问近处子节点，远处子节点连同其进入距离入栈，出栈时若进入距离已超过 tnear 则直接剔除
+#define KD_TRAVERSAL_STACK_SIZE 64
+
+inline PrimHit intersect_kd_tree(const LinearKDTree& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear);
+
+// 最近交点查询在叶子中的中间结果：命中图元在 primIndices(三角形为 triIndices)中的位置与类型
+struct NearestHit {
+    uint32_t slot = UINT32_MAX;
+    uint8_t type = LEAF_SPHERES;
+    PrimHit instanceHit;
+    float u = 0, v = 0;
+};
+
+// 测试叶子 [offset, offset + count) 中类型为 type 的图元，比 tnear 更近的交点更新 tnear 与 nearest
+inline void intersect_leaf(const LinearKDTree& tree, uint32_t offset, uint32_t count, uint8_t type, const Vec3f& rayorig, const Vec3f& raydir,
+                           const WatertightRay& wray, float& tnear, NearestHit& nearest) {
+    if (type == LEAF_INSTANCES) {
+        // 光线经逆变换进入物体空间，方向重新归一化，距离按方向的长度换算
+        for (uint32_t k = 0; k < count; ++k) {
+            const TreeInstance& inst = (*tree.instances)[tree.instIndices[offset + k]];
+            Vec3f d = inst.toObject.vector(raydir);
+            float len = d.length(), t = tnear * len;
+            PrimHit local = intersect_kd_tree(*inst.object, inst.toObject.point(rayorig), d / len, t);
+            if (local) {
+                tnear = t / len;
+                nearest.instanceHit = local;
+                nearest.instanceHit.instance = &inst;
+                nearest.slot = 0, nearest.type = LEAF_INSTANCES;
+            }
+        }
+        return;
+    }
+    // 逐组测试叶子中的 SoA 图元，只记录命中位置
+    uint32_t firstBlock = offset / SPHERE_BLOCK_SIZE;
+    uint32_t endBlock = (offset + count + SPHERE_BLOCK_SIZE - 1) / SPHERE_BLOCK_SIZE;
+    if (type == LEAF_TRIANGLES) {
+        for (uint32_t b = firstBlock; b < endBlock; ++b) {
+            int lane = intersect_triangle_block(tree.triBlocks[b], wray, tnear, nearest.u, nearest.v);
+            if (lane >= 0) nearest.slot = b * SPHERE_BLOCK_SIZE + lane, nearest.type = LEAF_TRIANGLES;
+        }
+        return;
+    }
+    for (uint32_t b = firstBlock; b < endBlock; ++b) {
+        int lane = intersect_sphere_block(tree.blocks[b], rayorig, raydir, tnear);
+        if (lane >= 0) nearest.slot = b * SPHERE_BLOCK_SIZE + lane, nearest.type = LEAF_SPHERES;
+    }
+}
+
+// 只为最终命中的图元访问完整的 Sphere / Triangle 对象
+inline PrimHit resolve_hit(const LinearKDTree& tree, const NearestHit& nearest) {
+    PrimHit hit;
+    if (nearest.slot == UINT32_MAX) return hit;
+    if (nearest.type == LEAF_INSTANCES) return nearest.instanceHit;
+    if (nearest.type == LEAF_TRIANGLES) {
+        hit.triangle = &tree.mesh->triangles[tree.triIndices[nearest.slot]];
+        hit.u = nearest.u, hit.v = nearest.v;
+    } else {
+        hit.sphere = tree.spheres + tree.primIndices[nearest.slot];
+    }
+    return hit;
+}
+
+inline PrimHit intersect_kd_tree(const LinearKDTree& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear) {
+    PrimHit hit;
+    if (tree.nodes.empty()) return hit;
+
+    struct StackEntry {
+        uint32_t index;
+        float t_enter;
+    };
+    StackEntry stack[KD_TRAVERSAL_STACK_SIZE];
+    int top = 0;
+
+    float t_enter, t_exit;
+    if (!tree.nodes[0].bbox.intersect(rayorig, raydir, t_enter, t_exit) || t_enter > tnear) return hit;
+    stack[top++] = {0, t_enter};
+
+    WatertightRay wray(rayorig, raydir);
+    NearestHit nearest;
+    while (top > 0) {
+        StackEntry entry = stack[--top];
+        if (entry.t_enter > tnear) continue; // 已找到比该节点入口更近的交点
+        const LinearKDNode& node = tree.nodes[entry.index];
+        RAY_STAT(nodes, 1);
+        RAY_STAT_FETCH(&node, sizeof(node));
+
+        if (node.count > 0) {
+            RAY_STAT(leaves, 1);
+            intersect_leaf(tree, node.offset, node.count, node.axis, rayorig, raydir, wray, tnear, nearest);
+            continue;
+        }
+
+        uint32_t nearIndex = entry.index + 1, farIndex = node.offset;
+        if (axis_value(raydir, node.axis) < 0) std::swap(nearIndex, farIndex);
+
+        // 远处子节点先入栈，近处子节点后入栈以便先出栈
+        RAY_STAT_FETCH(&tree.nodes[farIndex], sizeof(LinearKDNode));
+        RAY_STAT_FETCH(&tree.nodes[nearIndex], sizeof(LinearKDNode));
+        float t_far, t_near;
+        bool hitFar = tree.nodes[farIndex].bbox.intersect(rayorig, raydir, t_far, t_exit) && t_far <= tnear;
+        bool hitNear = tree.nodes[nearIndex].bbox.intersect(rayorig, raydir, t_near, t_exit) && t_near <= tnear;
+        if (hitFar) stack[top++] = {farIndex, t_far};
+        if (hitNear) stack[top++] = {nearIndex, t_near};
+    }
+    return resolve_hit(tree, nearest);
+}
+
+// 遮挡查询(any-hit)：[0, tmax) 内是否存在除 skipObject(hit_object 的编号，通常为光源)以外的任何图元
+// 阴影光线只关心有无遮挡，找到第一个遮挡物即返回，不需要按远近排序，也不更新 tmax
+inline bool occluded_kd_tree(const LinearKDTree& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject = -1);
+
+// 叶子 [offset, offset + count) 中是否有 [0, tmax) 内遮挡光线的图元(skipObject 除外)
+inline bool occluded_leaf(const LinearKDTree& tree, uint32_t offset, uint32_t count, uint8_t type, const Vec3f& rayorig, const Vec3f& raydir,
+                          const WatertightRay& wray, float tmax, int32_t skipObject) {
+    uint32_t skipIndex = uint32_t(skipObject); // -1 不与任何编号相等
+    if (type == LEAF_INSTANCES) {
+        uint32_t firstInstance = tree.sphereCount + tree.triangleCount();
+        for (uint32_t k = 0; k < count; ++k) {
+            uint32_t i = tree.instIndices[offset + k];
+            if (firstInstance + i == skipIndex) continue;
+            const TreeInstance& inst = (*tree.instances)[i];
+            Vec3f d = inst.toObject.vector(raydir);
+            float len = d.length();
+            if (occluded_kd_tree(*inst.object, inst.toObject.point(rayorig), d / len, tmax * len)) return true;
+        }
+        return false;
+    }
+    uint32_t firstBlock = offset / SPHERE_BLOCK_SIZE;
+    uint32_t endBlock = (offset + count + SPHERE_BLOCK_SIZE - 1) / SPHERE_BLOCK_SIZE;
+    if (type == LEAF_TRIANGLES) {
+        for (uint32_t b = firstBlock; b < endBlock; ++b) {
+            float t[SPHERE_BLOCK_SIZE], u[SPHERE_BLOCK_SIZE], v[SPHERE_BLOCK_SIZE];
+            int mask = triangle_block_hits(tree.triBlocks[b], wray, t, u, v);
+            for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+                if ((mask & 1) && t[lane] < tmax && tree.sphereCount + tree.triIndices[b * SPHERE_BLOCK_SIZE + lane] != skipIndex) return true;
+            }
+        }
+        return false;
+    }
+    for (uint32_t b = firstBlock; b < endBlock; ++b) {
+        float t[SPHERE_BLOCK_SIZE];
+        int mask = sphere_block_hits(tree.blocks[b], rayorig, raydir, t);
+        for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+            if ((mask & 1) && t[lane] < tmax && tree.primIndices[b * SPHERE_BLOCK_SIZE + lane] != skipIndex) return true;
+        }
+    }
+    return false;
+}
+
+inline bool occluded_kd_tree(const LinearKDTree& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject) {
+    if (tree.nodes.empty()) return false;
+    WatertightRay wray(rayorig, raydir);
+
+    uint32_t stack[KD_TRAVERSAL_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        const LinearKDNode& node = tree.nodes[index];
+        RAY_STAT_FETCH(&node, sizeof(node));
+        float t_enter, t_exit;
+        if (!node.bbox.intersect(rayorig, raydir, t_enter, t_exit) || t_enter > tmax) continue;
+        RAY_STAT(nodes, 1);
+
+        if (node.count > 0) {
+            RAY_STAT(leaves, 1);
+            if (occluded_leaf(tree, node.offset, node.count, node.axis, rayorig, raydir, wray, tmax, skipObject)) return true;
+            continue;
+        }
+        stack[top++] = node.offset;
+        stack[top++] = index + 1;
+    }
+    return false;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef MESH_H
+#define MESH_H
+#include <string>
+#include <vector>
+#include "element.h"
+
+// 通过 Project2 的 meshark 读取 Wavefront OBJ 网格，多边形面按扇形拆分为三角形
+// 顶点先缩放 scale 倍再平移 offset；顶点法线取相邻面法线按面积加权的平均
+// 三角形与材质追加到 mesh 末尾，失败时返回 false 且不修改 mesh
+// lods 非空时生成细节层次，第 k+1 级追加到 (*lods)[k]：存在同目录的 name.lod<k+1>.obj(与原网格同一物体空间)时直接读取，
+// 否则用 meshark::MeshSimplifier(二次误差边折叠)在上一级基础上简化，保留约 lodRatio 的边；
+// 非封闭三角形网格无法简化，沿用上一级
+bool load_obj_mesh(const std::string &path, const Vec3f &offset, float scale, const Material &material, TriangleMesh &mesh,
+                   std::vector<TriangleMesh> *lods = nullptr, float lodRatio = 0.25f);
+#endif
@@ -0,0 +1,31 @@
+#ifndef PACKET_H
+#define PACKET_H
+#include <cstdint>
+#include "kd_tree.h"
+
+// 光线包的最大宽度(AVX 8 路)
+#define MAX_PACKET_SIZE 8
+
+// 共享起点的主光线包，方向按分量分开存放(SoA)，便于 SIMD 加载
+struct RayPacket {
+    Vec3f orig;
+    alignas(32) float dx[MAX_PACKET_SIZE];
+    alignas(32) float dy[MAX_PACKET_SIZE];
+    alignas(32) float dz[MAX_PACKET_SIZE];
+    alignas(32) float tnear[MAX_PACKET_SIZE];   // 输入为最大距离，输出为最近交点距离
+    alignas(32) int32_t hit[MAX_PACKET_SIZE];   // 输出命中球体在 spheres 中的下标，-1 表示未命中
+    unsigned active = 0;                        // 有效光线的位掩码
+};
+
+// 光线包最近交点查询：width 为 4(SSE) 或 8(AVX)
+// 包内光线方向符号不一致(不相干)或树中含有三角形、实例时返回 false，调用方应退回逐条光线求交
+// 节点与球体的测试与标量版本逐条运算一致，因此命中结果与 intersect_kd_tree 相同
+bool intersect_packet(const LinearKDTree& tree, RayPacket& packet, unsigned width);
+
+// 当前 CPU 与编译目标实际支持的包宽度：请求 8 但不支持 AVX 时降为 4，无 SSE 时为 1
+unsigned supported_packet_width(unsigned requested);
+
+// 各指令集版本的实现，分别位于 packet_sse.cpp 与 packet_avx.cpp
+bool intersect_packet4(const LinearKDNode* nodes, const uint32_t* prims, const SphereBlock* blocks, RayPacket& packet);
+bool intersect_packet8(const LinearKDNode* nodes, const uint32_t* prims, const SphereBlock* blocks, RayPacket& packet);
+#endif
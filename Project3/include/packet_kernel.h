@@ -0,0 +1,104 @@
+#ifndef PACKET_KERNEL_H
+#define PACKET_KERNEL_H
+// 光线包遍历内核，仅由 packet_sse.cpp / packet_avx.cpp 包含
+// 两个编译单元使用不同的指令集编译，因此内核位于匿名命名空间中，
+// 且只读取原始指针与成员变量，避免 AVX 版本的内联函数副本被链接到其他编译单元
+#include <cmath>
+#include <cstdint>
+#include "packet.h"
+
+namespace {
+
+// 包遍历：S 为 SIMD 类型封装(SimdSSE / SimdAVX)
+template<typename S>
+bool packet_traverse(const LinearKDNode* nodes, const uint32_t* prims, const SphereBlock* blocks, RayPacket& p) {
+    typedef typename S::F F;
+    const unsigned valid = p.active & ((1u << S::N) - 1);
+    if (valid == 0) return true;
+
+    F d[3] = {S::load(p.dx), S::load(p.dy), S::load(p.dz)};
+    const float o[3] = {p.orig.x, p.orig.y, p.orig.z};
+
+    // 相干性检查：各轴方向符号在所有有效光线上必须一致，否则交给标量路径
+    bool negative[3];
+    for (int a = 0; a < 3; ++a) {
+        unsigned neg = S::movemask(S::cmplt(d[a], S::zero())) & valid;
+        if (neg != 0 && neg != valid) return false;
+        negative[a] = neg != 0;
+    }
+
+    // 与 AABB::intersect 相同：方向分量绝对值小于 1e-8 视为与该轴平行
+    // 标量版本以 double 比较，float 中与之等价的阈值是不小于 1e-8 的最小 float
+    F parallel[3];
+    const F eps = S::set1(std::nextafter(1e-8f, 1.0f));
+    for (int a = 0; a < 3; ++a) parallel[a] = S::cmplt(S::abs(d[a]), eps);
+
+    F validMask = S::lanemask(valid);
+    F tnear = S::load(p.tnear);
+    F hit = S::loadi(p.hit);
+    const F negInf = S::set1(-INFINITY), posInf = S::set1(INFINITY);
+
+    uint32_t stack[KD_TRAVERSAL_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        const LinearKDNode& node = nodes[index];
+        const float bmin[3] = {node.bbox.min.x, node.bbox.min.y, node.bbox.min.z};
+        const float bmax[3] = {node.bbox.max.x, node.bbox.max.y, node.bbox.max.z};
+
+        // Slab 测试，逐条光线的运算顺序与标量版本一致
+        F tmin = negInf, tmax = posInf, ok = validMask;
+        for (int a = 0; a < 3; ++a) {
+            F t1 = S::div(S::set1(bmin[a] - o[a]), d[a]);
+            F t2 = S::div(S::set1(bmax[a] - o[a]), d[a]);
+            F lo = S::min(t1, t2), hi = S::max(t1, t2);
+            lo = S::blend(parallel[a], lo, negInf);
+            hi = S::blend(parallel[a], hi, posInf);
+            if (o[a] < bmin[a] || o[a] > bmax[a]) ok = S::andnot(parallel[a], ok); // 平行且起点在 slab 外
+            tmin = S::max(tmin, lo);
+            tmax = S::min(tmax, hi);
+        }
+        F active = S::and_(ok, S::and_(S::cmple(tmin, tmax), S::and_(S::cmpgt(tmax, S::zero()), S::cmple(tmin, tnear))));
+        if (S::movemask(active) == 0) continue;
+
+        if (node.count > 0) {
+            for (uint32_t slot = node.offset; slot < node.offset + node.count; ++slot) {
+                // 从叶子的 SoA 组中读取球心与半径平方，不访问 Sphere 对象
+                const SphereBlock& b = blocks[slot / SPHERE_BLOCK_SIZE];
+                unsigned lane = slot % SPHERE_BLOCK_SIZE;
+                // l = center - rayorig，l.dot(l) 与起点相同，对所有光线只算一次
+                float lx = b.cx[lane] - p.orig.x, ly = b.cy[lane] - p.orig.y, lz = b.cz[lane] - p.orig.z;
+                float ll = lx * lx + ly * ly + lz * lz;
+                F tca = S::add(S::add(S::mul(S::set1(lx), d[0]), S::mul(S::set1(ly), d[1])), S::mul(S::set1(lz), d[2]));
+                F d2 = S::sub(S::set1(ll), S::mul(tca, tca));
+                F r2 = S::set1(b.r2[lane]);
+                F m = S::and_(active, S::and_(S::cmpge(tca, S::zero()), S::cmple(d2, r2)));
+                if (S::movemask(m) == 0) continue;
+                F thc = S::sqrt(S::max(S::sub(r2, d2), S::zero()));
+                F t0 = S::sub(tca, thc), t1 = S::add(tca, thc);
+                t0 = S::blend(S::cmplt(t0, S::zero()), t0, t1);
+                F closer = S::and_(m, S::cmplt(t0, tnear));
+                tnear = S::blend(closer, tnear, t0);
+                hit = S::blend(closer, hit, S::set1i((int32_t)prims[slot]));
+            }
+            continue;
+        }
+
+        // 包内方向符号一致，按共同的符号先访问近处子节点
+        uint32_t nearIndex = index + 1, farIndex = node.offset;
+        if (negative[node.axis]) {
+            nearIndex = node.offset;
+            farIndex = index + 1;
+        }
+        stack[top++] = farIndex;
+        stack[top++] = nearIndex;
+    }
+
+    S::store(p.tnear, tnear);
+    S::storei(p.hit, hit);
+    return true;
+}
+
+} // namespace
+#endif
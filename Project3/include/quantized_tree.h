@@ -0,0 +1,257 @@
+#ifndef QUANTIZED_TREE_H
+#define QUANTIZED_TREE_H
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "./kd_tree.h"
+
+// 压缩的树节点：包围盒以父节点(解码后)的包围盒为参照，每轴量化为 8 位整数，
+// 下界向下取整、上界向上取整，解码结果总是包含原包围盒，遍历只会多测试几个节点而不会漏掉交点
+// 节点 8 字节(LinearKDNode 为 32 字节)，不保存子节点下标：节点按层序存放，兄弟节点相邻，
+// 层序中第 r 个内部节点的两个子节点位于 2r + 1 与 2r + 2，r 由 QuantizedRank 的前缀计数求得
+struct QuantizedKDNode {
+    uint8_t lo[3], hi[3];
+    uint16_t meta; // 叶子：低 14 位为物体数(不为 0)，高 2 位为图元类型；内部节点：低 14 位为 0，高 2 位为划分轴
+
+    uint32_t count() const { return meta & 0x3FFF; }
+    uint8_t axis() const { return uint8_t(meta >> 14); }
+};
+
+// 每 32 个节点一项的秩目录：之前的叶子数与这 32 个节点中叶子的位图
+struct QuantizedRank {
+    uint32_t leaves;
+    uint32_t mask;
+};
+
+// 量化树只替换节点数组，叶子几何、图元下标与实例仍然使用原树(base)，base 在其生命周期内不能修改
+// 叶子在图元下标数组中的起点按层序中叶子的序号存放在 leafOffsets 中(每个叶子 4 字节)
+struct QuantizedKDTree {
+    const LinearKDTree* base = nullptr;
+    AABB rootBox; // 根节点解码后的包围盒，以 float 保存
+    std::vector<QuantizedKDNode> nodes;
+    std::vector<QuantizedRank> ranks;
+    std::vector<uint32_t> leafOffsets;
+
+    // 层序中节点 i 之前的叶子数
+    uint32_t leavesBefore(uint32_t i) const {
+        const QuantizedRank& r = ranks[i >> 5];
+        // 未启用 -mpopcnt 时 __builtin_popcount 是对 libgcc 的函数调用，这里直接按位累加
+        uint32_t x = r.mask & ((1u << (i & 31)) - 1);
+        x = x - ((x >> 1) & 0x55555555u);
+        x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+        return r.leaves + ((((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+    }
+    // 内部节点 i 的第一个子节点，第二个子节点紧随其后
+    uint32_t firstChild(uint32_t i) const { return 2 * (i - leavesBefore(i)) + 1; }
+    uint32_t leafOffset(uint32_t i) const { return leafOffsets[leavesBefore(i)]; }
+
+    size_t memoryBytes() const {
+        return nodes.size() * sizeof(QuantizedKDNode) + ranks.size() * sizeof(QuantizedRank) + leafOffsets.size() * sizeof(uint32_t);
+    }
+};
+
+// 父节点包围盒解码出的量化刻度：下界 + q * step
+// step 比 extent / qmax 略大(相对 2^-20，远大于几次 float 舍入的误差)，qmax 解码后不小于父节点的上界
+struct QuantizedFrame {
+    Vec3f origin, step;
+
+    explicit QuantizedFrame(const AABB& box) : origin(box.min) {
+        const float scale = (1 + 1.0f / (1 << 20)) / float(std::numeric_limits<uint8_t>::max());
+        step = (box.max - box.min) * scale;
+    }
+    float decode(int axis, uint8_t q) const { return axis_value(origin, axis) + float(q) * axis_value(step, axis); }
+    AABB decode(const QuantizedKDNode& node) const {
+        return AABB(Vec3f(decode(0, node.lo[0]), decode(1, node.lo[1]), decode(2, node.lo[2])),
+                    Vec3f(decode(0, node.hi[0]), decode(1, node.hi[1]), decode(2, node.hi[2])));
+    }
+};
+
+// 量化一个节点：先按比例取整，再用与遍历完全相同的解码运算修正，保证解码结果向外包含原包围盒
+inline QuantizedKDNode quantize_node(const LinearKDNode& node, const QuantizedFrame& frame) {
+    QuantizedKDNode q;
+    const int qmax = std::numeric_limits<uint8_t>::max();
+    for (int a = 0; a < 3; ++a) {
+        float step = axis_value(frame.step, a), base = axis_value(frame.origin, a);
+        float lo = axis_value(node.bbox.min, a), hi = axis_value(node.bbox.max, a);
+        int qlo = 0, qhi = qmax;
+        if (step > 0) {
+            qlo = std::max(0, std::min(qmax, int(std::floor((lo - base) / step))));
+            qhi = std::max(0, std::min(qmax, int(std::ceil((hi - base) / step))));
+        }
+        while (qlo > 0 && frame.decode(a, uint8_t(qlo)) > lo) --qlo;
+        while (qhi < qmax && frame.decode(a, uint8_t(qhi)) < hi) ++qhi;
+        q.lo[a] = uint8_t(qlo), q.hi[a] = uint8_t(qhi);
+    }
+    q.meta = uint16_t(node.count | uint32_t(node.axis) << 14);
+    return q;
+}
+
+// 由线性树生成量化树：按层序逐个量化，子节点相对父节点解码后(而不是原始)的包围盒量化，与遍历时看到的完全一致
+// 叶子物体数超过 14 位可表示的范围时返回 false
+inline bool quantize_linear_tree(const LinearKDTree& tree, QuantizedKDTree& out) {
+    out.base = &tree;
+    out.nodes.clear();
+    out.ranks.clear();
+    out.leafOffsets.clear();
+    // 只有一个空叶子的树(没有图元)没有可遍历的节点
+    if (tree.nodes.empty() || (tree.nodes.size() == 1 && tree.nodes[0].count == 0)) return true;
+    for (const LinearKDNode& node : tree.nodes) {
+        if (node.count > 0x3FFF) return false;
+    }
+
+    // order[i] 为层序中第 i 个节点在线性树中的下标，boxes[i] 为它解码后的包围盒
+    std::vector<uint32_t> order;
+    std::vector<AABB> boxes;
+    order.reserve(tree.nodes.size()), boxes.reserve(tree.nodes.size());
+    out.nodes.reserve(tree.nodes.size());
+    out.ranks.reserve(tree.nodes.size() / 32 + 1);
+    // 根节点以自身的包围盒为参照(量化结果为满刻度)，遍历从它解码后的包围盒开始
+    QuantizedFrame rootFrame(tree.nodes[0].bbox);
+    out.nodes.push_back(quantize_node(tree.nodes[0], rootFrame));
+    order.push_back(0), boxes.push_back(rootFrame.decode(out.nodes[0]));
+    for (size_t i = 0; i < order.size(); ++i) {
+        const LinearKDNode& node = tree.nodes[order[i]];
+        if (i % 32 == 0) out.ranks.push_back({uint32_t(out.leafOffsets.size()), 0});
+        if (node.count > 0) {
+            out.ranks.back().mask |= 1u << (i % 32);
+            out.leafOffsets.push_back(node.offset);
+            continue;
+        }
+        QuantizedFrame frame(boxes[i]);
+        for (uint32_t child : {order[i] + 1, node.offset}) {
+            out.nodes.push_back(quantize_node(tree.nodes[child], frame));
+            order.push_back(child), boxes.push_back(frame.decode(out.nodes.back()));
+        }
+    }
+    out.rootBox = boxes[0];
+    return true;
+}
+
+// 内部节点的两个子节点(相邻的 16 字节)一起解码并做 slab 测试，运算与 QuantizedFrame::decode、AABB::intersect 逐项相同，结果完全一致
+// 返回命中掩码(bit c 对应第 c 个子节点)，命中的子节点解码后的包围盒与入口距离写入 boxes / t_enter
+inline unsigned quantized_child_hits(const QuantizedKDNode* children, const QuantizedFrame& frame, const Vec3f& rayorig, const Vec3f& raydir,
+                                     AABB boxes[2], float t_enter[2]) {
+#if defined(__SSE2__)
+    RAY_STAT(boxes, 2);
+    // 各通道依次为 [子节点 0 下界, 子节点 0 上界, 子节点 1 下界, 子节点 1 上界]
+    alignas(16) float bounds[3][4];
+    __m128 tmin = _mm_set1_ps(-INFINITY), tmax = _mm_set1_ps(INFINITY);
+    unsigned outside = 0;
+    for (int a = 0; a < 3; ++a) {
+        __m128 q = _mm_cvtepi32_ps(_mm_setr_epi32(children[0].lo[a], children[0].hi[a], children[1].lo[a], children[1].hi[a]));
+        __m128 v = _mm_add_ps(_mm_set1_ps(axis_value(frame.origin, a)), _mm_mul_ps(q, _mm_set1_ps(axis_value(frame.step, a))));
+        _mm_store_ps(bounds[a], v);
+        float o = axis_value(rayorig, a), d = axis_value(raydir, a);
+        if (std::abs(d) < 1e-8) {
+            // 光线平行于该轴，起点不在范围内的子节点不相交
+            for (int c = 0; c < 2; ++c) {
+                if (o < bounds[a][2 * c] || o > bounds[a][2 * c + 1]) outside |= 1u << c;
+            }
+            continue;
+        }
+        __m128 t = _mm_div_ps(_mm_sub_ps(v, _mm_set1_ps(o)), _mm_set1_ps(d));
+        __m128 swapped = _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1));
+        tmin = _mm_max_ps(tmin, _mm_min_ps(t, swapped));
+        tmax = _mm_min_ps(tmax, _mm_max_ps(t, swapped));
+    }
+    alignas(16) float enter[4], exit[4];
+    _mm_store_ps(enter, tmin);
+    _mm_store_ps(exit, tmax);
+    unsigned mask = 0;
+    for (int c = 0; c < 2; ++c) {
+        if ((outside >> c & 1) || enter[2 * c] > exit[2 * c] || !(exit[2 * c] > 0)) continue;
+        boxes[c] = AABB(Vec3f(bounds[0][2 * c], bounds[1][2 * c], bounds[2][2 * c]), Vec3f(bounds[0][2 * c + 1], bounds[1][2 * c + 1], bounds[2][2 * c + 1]));
+        t_enter[c] = enter[2 * c];
+        mask |= 1u << c;
+    }
+    return mask;
+#else
+    unsigned mask = 0;
+    for (int c = 0; c < 2; ++c) {
+        float t_exit;
+        boxes[c] = frame.decode(children[c]);
+        if (boxes[c].intersect(rayorig, raydir, t_enter[c], t_exit)) mask |= 1u << c;
+    }
+    return mask;
+#endif
+}
+
+// 量化树上的最近交点查询，与 intersect_kd_tree 的遍历顺序相同
+// 栈中同时保存节点解码后的包围盒，子节点的包围盒在访问父节点时解码
+inline PrimHit intersect_quantized_tree(const QuantizedKDTree& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear) {
+    if (tree.nodes.empty()) return PrimHit();
+
+    struct StackEntry {
+        uint32_t index;
+        float t_enter;
+        AABB box;
+    };
+    StackEntry stack[KD_TRAVERSAL_STACK_SIZE];
+    int top = 0;
+
+    float t_enter, t_exit;
+    if (!tree.rootBox.intersect(rayorig, raydir, t_enter, t_exit) || t_enter > tnear) return PrimHit();
+    stack[top++] = {0, t_enter, tree.rootBox};
+
+    WatertightRay wray(rayorig, raydir);
+    NearestHit nearest;
+    while (top > 0) {
+        StackEntry entry = stack[--top];
+        if (entry.t_enter > tnear) continue;
+        const QuantizedKDNode& node = tree.nodes[entry.index];
+        RAY_STAT(nodes, 1);
+
+        if (node.count() > 0) {
+            RAY_STAT(leaves, 1);
+            intersect_leaf(*tree.base, tree.leafOffset(entry.index), node.count(), node.axis(), rayorig, raydir, wray, tnear, nearest);
+            continue;
+        }
+
+        uint32_t first = tree.firstChild(entry.index);
+        AABB boxes[2];
+        float t_child[2];
+        unsigned hits = quantized_child_hits(&tree.nodes[first], QuantizedFrame(entry.box), rayorig, raydir, boxes, t_child);
+        // 远的子节点先入栈
+        int nearSide = axis_value(raydir, node.axis()) < 0 ? 1 : 0;
+        for (int c : {1 - nearSide, nearSide}) {
+            if ((hits >> c & 1) && t_child[c] <= tnear) stack[top++] = {first + c, t_child[c], boxes[c]};
+        }
+    }
+    return resolve_hit(*tree.base, nearest);
+}
+
+// 量化树上的遮挡查询，语义与 occluded_kd_tree 相同
+inline bool occluded_quantized_tree(const QuantizedKDTree& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject = -1) {
+    if (tree.nodes.empty()) return false;
+    float t_enter, t_exit;
+    if (!tree.rootBox.intersect(rayorig, raydir, t_enter, t_exit) || t_enter > tmax) return false;
+    WatertightRay wray(rayorig, raydir);
+
+    struct StackEntry {
+        uint32_t index;
+        AABB box;
+    };
+    StackEntry stack[KD_TRAVERSAL_STACK_SIZE];
+    int top = 0;
+    stack[top++] = {0, tree.rootBox};
+    while (top > 0) {
+        StackEntry entry = stack[--top];
+        const QuantizedKDNode& node = tree.nodes[entry.index];
+        RAY_STAT(nodes, 1);
+
+        if (node.count() > 0) {
+            RAY_STAT(leaves, 1);
+            if (occluded_leaf(*tree.base, tree.leafOffset(entry.index), node.count(), node.axis(), rayorig, raydir, wray, tmax, skipObject)) return true;
+            continue;
+        }
+        uint32_t first = tree.firstChild(entry.index);
+        AABB boxes[2];
+        float t_child[2];
+        unsigned hits = quantized_child_hits(&tree.nodes[first], QuantizedFrame(entry.box), rayorig, raydir, boxes, t_child);
+        for (int c : {1, 0}) {
+            if ((hits >> c & 1) && t_child[c] <= tmax) stack[top++] = {first + c, boxes[c]};
+        }
+    }
+    return false;
+}
+#endif
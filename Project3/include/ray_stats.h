@@ -0,0 +1,66 @@
+#ifndef RAY_STATS_H
+#define RAY_STATS_H
+#include <cstddef>
+#include <cstdint>
+
+// 光线遍历统计：访问的树节点与叶子、包围盒测试、图元测试(SIMD 按通道计)、派生的次级光线(反射、折射、阴影)，
+// 以及节点与叶子几何在模拟缓存中的缺失次数(见 CacheModel)
+// 只有以 RAY_STATS 编译(make STATS=1)时才计数；否则 RAY_STAT 展开为空语句，遍历代码与不统计时完全相同
+struct RayStats {
+    uint64_t nodes = 0;
+    uint64_t leaves = 0;
+    uint64_t boxes = 0;
+    uint64_t prims = 0;
+    uint64_t secondary = 0;
+    uint64_t misses = 0;
+
+    RayStats& operator+=(const RayStats& o) {
+        nodes += o.nodes, leaves += o.leaves, boxes += o.boxes, prims += o.prims, secondary += o.secondary, misses += o.misses;
+        return *this;
+    }
+    RayStats operator-(const RayStats& o) const {
+        RayStats d;
+        d.nodes = nodes - o.nodes, d.leaves = leaves - o.leaves, d.boxes = boxes - o.boxes, d.prims = prims - o.prims;
+        d.secondary = secondary - o.secondary, d.misses = misses - o.misses;
+        return d;
+    }
+};
+
+#ifdef RAY_STATS
+// 每个线程一个的缓存模型：32 KiB、8 路组相联、64 字节行、LRU 替换(与常见的 L1 数据缓存相同)
+// 只模拟线性树遍历读取的节点与叶子几何块，栈、光线与着色数据不计；
+// 遍历次数与光线的处理顺序无关，缺失次数则反映相邻光线之间节点与叶子的复用(如波前引擎的光线重排)
+struct CacheModel {
+    static const unsigned SETS = 64, WAYS = 8;
+    uintptr_t lines[SETS][WAYS] = {}; // 每组按最近使用排序，lines[s][0] 最新
+
+    // 访问一个缓存行，返回是否缺失
+    bool access(uintptr_t line) {
+        uintptr_t* set = lines[line % SETS];
+        unsigned way = 0;
+        while (way < WAYS - 1 && set[way] != line) ++way;
+        bool miss = set[way] != line;
+        for (; way > 0; --way) set[way] = set[way - 1];
+        set[0] = line;
+        return miss;
+    }
+};
+
+// 每个线程独立累加，渲染器在像素前后取差值得到该像素的开销
+inline thread_local RayStats t_rayStats;
+inline thread_local CacheModel t_cacheModel;
+
+// 读取 [p, p + bytes) 覆盖的每个缓存行，缺失时计数
+inline void ray_stat_fetch(const void* p, size_t bytes) {
+    uintptr_t first = uintptr_t(p) / 64, last = (uintptr_t(p) + bytes - 1) / 64;
+    for (uintptr_t line = first; line <= last; ++line) t_rayStats.misses += t_cacheModel.access(line);
+}
+
+#define RAY_STAT(field, n) (t_rayStats.field += (n))
+#define RAY_STAT_FETCH(p, bytes) ray_stat_fetch((p), (bytes))
+#else
+#define RAY_STAT(field, n) ((void)0)
+#define RAY_STAT_FETCH(p, bytes) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include <vector>
+#include "element.h"
+
+// 相机位姿：位置、观察目标点、视场角
+struct CameraPose {
+    Vec3f pos, target;
+    float fov;
+};
+
+// 默认场景：地面、四个反射球与一个光源
+void default_scene(std::vector<Sphere> &spheres);
+
+// 从文本文件读取场景，每行一个球体或网格(# 开头为注释)：
+// sphere cx cy cz radius r g b [reflectivity transparency er eg eb]
+// mesh file.obj tx ty tz scale r g b [reflectivity transparency er eg eb]
+// 网格文件的相对路径相对于场景文件所在目录；mesh 为空时不允许出现网格
+// 实例化：object name ... end 之间的球体与网格定义一个物体空间中的原型，
+// instance name tx ty tz [scale yaw] 把原型缩放、绕 y 轴旋转 yaw 度后放到 (tx, ty, tz)；instances 为空时不允许出现
+// object name levels 另外为其中的网格生成 levels 级逐级简化的细节层次，渲染时按实例在画面中的大小选择
+bool load_scene(const char *path, std::vector<Sphere> &spheres, TriangleMesh *mesh = nullptr, InstanceSet *instances = nullptr);
+
+// 动画：以 rest 中的位置为静止位置，把 t 时刻(秒)的球心写入 spheres(两者一一对应)
+// 普通球体原地上下弹跳，发光球体绕静止位置做水平圆周运动，半径很大的地面球体保持不动
+void animate_scene(const std::vector<Sphere> &rest, float t, std::vector<Sphere> &spheres);
+
+// 从文本文件读取相机路径，每行一个位姿(# 开头为注释)：
+// px py pz tx ty tz fov
+bool load_camera_path(const char *path, std::vector<CameraPose> &poses);
+#endif
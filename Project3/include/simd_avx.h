@@ -0,0 +1,42 @@
+#ifndef SIMD_AVX_H
+#define SIMD_AVX_H
+// AVX 8 路 SIMD 封装，只能由以 -mavx 编译的文件(packet_avx.cpp / wide_avx.cpp)包含
+#include <cstdint>
+#include <immintrin.h>
+
+namespace {
+struct SimdAVX {
+    typedef __m256 F;
+    static const int N = 8;
+    static F zero() { return _mm256_setzero_ps(); }
+    static F set1(float v) { return _mm256_set1_ps(v); }
+    static F set1i(int32_t v) { return _mm256_castsi256_ps(_mm256_set1_epi32(v)); }
+    static F load(const float* p) { return _mm256_load_ps(p); }
+    static F loadi(const int32_t* p) { return _mm256_castsi256_ps(_mm256_load_si256((const __m256i*)p)); }
+    static void store(float* p, F v) { _mm256_store_ps(p, v); }
+    static void storei(int32_t* p, F v) { _mm256_store_si256((__m256i*)p, _mm256_castps_si256(v)); }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static F abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static F cmplt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static F cmple(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static F cmpgt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static F cmpge(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static F and_(F a, F b) { return _mm256_and_ps(a, b); }
+    static F andnot(F a, F b) { return _mm256_andnot_ps(a, b); } // (~a) & b
+    // mask 为真的通道取 b，否则取 a
+    static F blend(F mask, F a, F b) { return _mm256_blendv_ps(a, b, mask); }
+    static int movemask(F a) { return _mm256_movemask_ps(a); }
+    static F lanemask(unsigned bits) {
+        return _mm256_castsi256_ps(_mm256_set_epi32(
+            bits & 128 ? -1 : 0, bits & 64 ? -1 : 0, bits & 32 ? -1 : 0, bits & 16 ? -1 : 0,
+            bits & 8 ? -1 : 0, bits & 4 ? -1 : 0, bits & 2 ? -1 : 0, bits & 1 ? -1 : 0));
+    }
+};
+} // namespace
+#endif
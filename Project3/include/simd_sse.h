@@ -0,0 +1,41 @@
+#ifndef SIMD_SSE_H
+#define SIMD_SSE_H
+// SSE 4 路 SIMD 封装，供光线包与宽树的模板内核使用
+// 与 simd_avx.h 一样位于匿名命名空间中：不同指令集编译的文件各自持有一份，不会在链接时互相替换
+#include <cstdint>
+#include <emmintrin.h>
+
+namespace {
+struct SimdSSE {
+    typedef __m128 F;
+    static const int N = 4;
+    static F zero() { return _mm_setzero_ps(); }
+    static F set1(float v) { return _mm_set1_ps(v); }
+    static F set1i(int32_t v) { return _mm_castsi128_ps(_mm_set1_epi32(v)); }
+    static F load(const float* p) { return _mm_load_ps(p); }
+    static F loadi(const int32_t* p) { return _mm_castsi128_ps(_mm_load_si128((const __m128i*)p)); }
+    static void store(float* p, F v) { _mm_store_ps(p, v); }
+    static void storei(int32_t* p, F v) { _mm_store_si128((__m128i*)p, _mm_castps_si128(v)); }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F min(F a, F b) { return _mm_min_ps(a, b); }
+    static F max(F a, F b) { return _mm_max_ps(a, b); }
+    static F sqrt(F a) { return _mm_sqrt_ps(a); }
+    static F abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static F cmplt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static F cmple(F a, F b) { return _mm_cmple_ps(a, b); }
+    static F cmpgt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+    static F cmpge(F a, F b) { return _mm_cmpge_ps(a, b); }
+    static F and_(F a, F b) { return _mm_and_ps(a, b); }
+    static F andnot(F a, F b) { return _mm_andnot_ps(a, b); } // (~a) & b
+    // mask 为真的通道取 b，否则取 a (SSE2 没有 blendv)
+    static F blend(F mask, F a, F b) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+    static int movemask(F a) { return _mm_movemask_ps(a); }
+    static F lanemask(unsigned bits) {
+        return _mm_castsi128_ps(_mm_set_epi32(bits & 8 ? -1 : 0, bits & 4 ? -1 : 0, bits & 2 ? -1 : 0, bits & 1 ? -1 : 0));
+    }
+};
+} // namespace
+#endif
@@ -0,0 +1,148 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 任务组：记录尚未完成的任务数，wait() 时等待其归零
+struct TaskGroup {
+    std::atomic<size_t> pending{0};
+};
+
+// 工作窃取线程池
+// 每个工作线程拥有一个双端队列：自己从队尾取任务(LIFO，缓存友好)，
+// 空闲时从其他线程的队首窃取任务(FIFO，先偷走最早、通常最大的任务)。
+// 调用线程在 wait() 中同样参与执行任务，因此 threads=1 时退化为串行执行。
+class WorkStealingPool
+{
+public:
+    // threads：参与计算的线程总数(包含调用线程)，0 表示使用硬件线程数
+    explicit WorkStealingPool(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        // 0 号队列留给外部调用线程，其余队列各对应一个工作线程
+        for (unsigned i = 0; i < threads; ++i) queues.emplace_back(new Queue());
+        for (unsigned i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned size() const { return (unsigned)queues.size(); }
+
+    // 当前线程在池中的编号，外部线程为 0
+    static unsigned currentWorker() { return workerIndex() < 0 ? 0 : (unsigned)workerIndex(); }
+
+    // 提交任务到当前线程的队列，任务可以继续嵌套提交子任务
+    void run(TaskGroup& group, std::function<void()> fn) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Queue& q = *queues[currentWorker() % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(Task{std::move(fn), &group});
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            ++queued;
+        }
+        sleepCv.notify_one();
+    }
+
+    // 等待任务组完成，等待期间执行(或窃取)其他任务而不是阻塞
+    void wait(TaskGroup& group) {
+        unsigned self = currentWorker() % queues.size();
+        while (group.pending.load(std::memory_order_acquire) != 0) {
+            Task task;
+            if (tryGet(self, task)) execute(task);
+            else std::this_thread::yield();
+        }
+    }
+
+    // 并行执行 fn(i, worker)，i ∈ [0, n)，阻塞直到全部完成
+    void parallel_for(size_t n, const std::function<void(size_t, unsigned)>& fn) {
+        TaskGroup group;
+        for (size_t i = 0; i < n; ++i) {
+            run(group, [&fn, i] { fn(i, currentWorker()); });
+        }
+        wait(group);
+    }
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group = nullptr;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCv;
+    size_t queued = 0;      // 所有队列中的任务总数，受 sleepMutex 保护
+    bool stopping = false;
+
+    static int& workerIndex() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    // 先从自己的队尾取，再依次从其他队列的队首窃取
+    bool tryGet(unsigned self, Task& out) {
+        unsigned n = (unsigned)queues.size();
+        for (unsigned k = 0; k < n; ++k) {
+            Queue& q = *queues[(self + k) % n];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+            if (k == 0) {
+                out = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                out = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> sleepLock(sleepMutex);
+            --queued;
+            return true;
+        }
+        return false;
+    }
+
+    void execute(Task& task) {
+        task.fn();
+        task.group->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void workerLoop(unsigned index) {
+        workerIndex() = (int)index;
+        while (true) {
+            Task task;
+            if (tryGet(index, task)) {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCv.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+};
+
+#endif
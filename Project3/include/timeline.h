@@ -0,0 +1,44 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+#include <atomic>
+#include <cstdint>
+
+// 渲染各阶段的时间线：以 Chrome trace-event JSON 导出，可直接在 Perfetto (ui.perfetto.dev) 或 chrome://tracing 中打开
+// 每个线程把事件追加到自己的缓冲区，记录时不加锁；未开启记录时作用域计时只读取一个原子标志
+extern std::atomic<bool> g_timelineEnabled;
+
+inline bool timeline_enabled() {
+    return g_timelineEnabled.load(std::memory_order_relaxed);
+}
+
+// 清空之前的事件并开始记录
+void timeline_start();
+// 停止记录，把所有线程的事件写入 filename；调用时不应有线程仍在记录
+bool timeline_stop(const char *filename);
+
+// 单调时钟(纳秒)
+int64_t timeline_now();
+// 记录一个完整事件(ph = X)；argName 非空时写出 args.{argName} = arg
+void timeline_record(const char *name, const char *category, const char *argName, int64_t arg, int64_t beginNs, int64_t endNs);
+
+// 作用域计时：构造到析构之间记为一个事件，name 与 category 须为字符串常量
+// name 为空或未开启记录时不做任何事
+class TimelineScope {
+public:
+    TimelineScope(const char *name, const char *category, const char *argName = nullptr, int64_t arg = 0)
+        : name(name && timeline_enabled() ? name : nullptr), category(category), argName(argName), arg(arg),
+          begin(this->name ? timeline_now() : 0) {}
+    ~TimelineScope() {
+        if (name) timeline_record(name, category, argName, arg, begin, timeline_now());
+    }
+    TimelineScope(const TimelineScope&) = delete;
+    TimelineScope& operator=(const TimelineScope&) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    const char *argName;
+    int64_t arg;
+    int64_t begin;
+};
+#endif
@@ -1,16 +1,140 @@
 #ifndef TRACE_H
 #define TRACE_H
+#include <cstdint>
 #include <vector>
 #include "element.h"
+#include "image_sink.h"
 #define MAX_RAY_DEPTH 5
 
+struct PrimHit;
+
+// 一帧的逐像素遍历统计(见 ray_stats.h，需以 RAY_STATS 编译)：pixels 行优先、y 自上而下，totals 为整帧合计
+struct FrameStats {
+    unsigned width = 0, height = 0;
+    std::vector<RayStats> pixels;
+    RayStats totals;
+};
+
+// 波前引擎中次级光线(深度 >= 1 的 extend)与阴影光线阶段的累计开销，用于比较光线重排的效果
+// 耗时总是记录(不含排序本身，排序单独计时)；遍历计数只有以 RAY_STATS 编译时才有值
+struct WavefrontStats {
+    uint64_t secondaryRays = 0, shadowRays = 0;
+    double secondaryMs = 0, shadowMs = 0, sortMs = 0;
+    RayStats secondary, shadow;
+};
+
+// 渲染参数：输出分辨率与多线程分块渲染
+struct RenderSettings {
+    unsigned width = 640;    // 图像宽度(像素)
+    unsigned height = 480;   // 图像高度(像素)
+    float aspect = 0;        // 画面宽高比，0 表示使用 width / height
+    unsigned threads = 0;    // 渲染线程数，0 表示使用全部硬件线程
+    unsigned tileSize = 32;  // 分块边长(像素)，流式输出时也是行带高度
+    unsigned packetWidth = 1;// 主光线包宽度：1 逐条跟踪，4 使用 SSE，8 使用 AVX(不支持时自动降级)
+    unsigned lightSamples = 0;// 每个漫反射交点按功率随机采样的光源数，0 表示计算全部光源
+    bool wavefront = false;  // 使用波前引擎(按深度分批的 SoA 光线队列)代替逐像素递归 trace；开启自适应反走样或遍历统计时不生效，退回逐像素 trace
+    bool sortRays = true;    // 波前引擎中次级光线与阴影光线按起点 Morton 码与方向卦限排序后再遍历
+    unsigned aaSamples = 0;  // 自适应反走样：边缘像素追加的子采样数上限(取 n x n，n = floor(sqrt))，0 表示关闭
+    float aaThreshold = 0.1f;// 相邻像素颜色差超过该值(或命中物体不同)时视为边缘
+    float reprojectThreshold = 0.02f;   // 重投影误差阈值(亚像素偏移 x 邻域颜色差)，超过则重新跟踪
+    bool reprojectViewDependent = false;// 是否也复用反射/透明等与视角相关材质的像素(会产生误差)
+    float lodPixels = 128;   // 实例在画面上的直径不超过该值的一半(像素)时使用第 1 级简化网格，之后每减半下降一级，0 表示总是使用原网格
+    WavefrontStats *wavefrontStats = nullptr;// 非空时波前引擎把各阶段的开销累加到其中(调用方负责清零)
+    FrameStats *stats = nullptr;// 非空时 renderToBuffer / renderReprojected 写入逐像素遍历统计(光线包与波前引擎退回逐条跟踪)
+};
+
+// 由像素编号、子采样编号与路径编号得到一条光线的随机数种子(非 0)
+inline uint32_t sample_seed(uint32_t pixel, uint32_t sample, uint32_t path) {
+    uint32_t h = pixel * 0x9E3779B1u ^ sample * 0x85EBCA77u ^ path * 0xC2B2AE3Du;
+    h ^= h >> 16, h *= 0x7FEB352Du, h ^= h >> 15, h *= 0x846CA68Bu, h ^= h >> 16;
+    return h ? h : 1;
+}
+
+// xorshift32，推进 state 并返回 [0, 1) 的均匀随机数
+inline float next_random(uint32_t &state) {
+    uint32_t x = state;
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    state = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// 光源采样状态，随光线显式传入 trace / shade
+// 每条光线的随机数只取决于所在像素、子采样与它在递归树中的位置(路径编号：主光线为 1，反射光线为 2p，折射光线为 2p + 1)，
+// 逐像素 trace 与波前引擎对同一条光线选出相同的光源，结果与分块、行带划分和线程调度无关
+struct LightSampler {
+    unsigned lightSamples; // 同 RenderSettings::lightSamples
+    uint32_t pixel;        // 像素编号 y * width + x
+    uint32_t sample;       // 0 为像素中心的采样，反走样的子采样从 1 开始
+    uint32_t path;
+
+    LightSampler(unsigned lightSamples, uint32_t pixel, uint32_t sample = 0, uint32_t path = 1)
+        : lightSamples(lightSamples), pixel(pixel), sample(sample), path(path) {}
+
+    LightSampler reflected() const { return LightSampler(lightSamples, pixel, sample, path * 2); }
+    LightSampler refracted() const { return LightSampler(lightSamples, pixel, sample, path * 2 + 1); }
+    uint32_t seed() const { return sample_seed(pixel, sample, path); }
+};
+
 Vec3f trace(
     const Vec3f &rayorig, 
     const Vec3f &raydir, 
     const std::vector<Sphere> &spheres, 
-    const int &depth
+    const int &depth,
+    const LightSampler &sampler
+);
+
+// 对已求得的最近交点(球体或三角形)着色：反射/折射递归调用 trace，漫反射计算阴影
+Vec3f shade(
+    const Vec3f &rayorig,
+    const Vec3f &raydir,
+    const PrimHit &hit,
+    float tnear,
+    const std::vector<Sphere> &spheres,
+    int depth,
+    const LightSampler &sampler
 );
 
+// 选择场景查询使用的树：width 为 4 或 8 时由当前的 g_kdTree 折叠出对应的宽树(wide_tree.h)，
+// 之后 trace、波前引擎与重投影的最近交点和遮挡查询都遍历宽树(主光线包仍遍历二叉树)；0 恢复使用二叉线性树
+// 宽树复制了节点的包围盒，g_kdTree 每次重建或 refit 之后都要重新调用；不能与渲染同时调用。返回宽树节点的内存(字节)
+size_t use_wide_tree(unsigned width);
+
+// 场景的最近交点与遮挡查询，按 use_wide_tree 的选择遍历二叉线性树或宽树，语义与 intersect_kd_tree / occluded_kd_tree 相同
+PrimHit intersect_scene(const Vec3f &rayorig, const Vec3f &raydir, float &tnear);
+bool occluded_scene(const Vec3f &rayorig, const Vec3f &raydir, float tmax, int32_t skipObject = -1);
+
+// 时域重投影缓存：保存上一帧每个像素主光线的命中点、命中物体与颜色
+// 新一帧将这些点投影到新相机下复用，只重新跟踪空洞、物体边缘与误差较大的像素
+struct FrameCache {
+    unsigned width = 0, height = 0;     // 0 表示缓存为空
+    Vec3f camPos, camTarget;            // 上一帧的相机
+    float fov = 0;
+    std::vector<Vec3f> point;           // 命中点；未命中时为光线方向(不参与重投影)
+    std::vector<Vec3f> color;
+    std::vector<int32_t> object;        // 命中物体的编号(hit_object)，-1 表示未命中
+    size_t retraced = 0;                // 最近一帧重新跟踪的像素数
+
+    // 重投影过程中使用的缓冲区，跨帧复用
+    std::vector<Vec3f> nextPoint, nextColor;
+    std::vector<int32_t> nextObject;
+    std::vector<float> depth, offset;
+    std::vector<uint8_t> retrace;
+
+    void clear() { width = height = 0; }
+};
+
+// 已跟踪的光线数(主光线、反射/折射光线与阴影光线)，用于统计吞吐率
+uint64_t ray_count();
+void reset_ray_count();
+// 不经过 trace 的渲染路径(如波前引擎)批量累加光线数
+void add_ray_count(uint64_t n);
+
+// 渲染共用的线程池，线程数变化时重建
+class WorkStealingPool;
+WorkStealingPool& render_pool(unsigned threads);
+
+float mix(const float &a, const float &b, const float &mix);
+
 // 相机位置、目标点、FOV参数
 void render(
     const std::vector<Sphere> &spheres
@@ -21,8 +145,55 @@ void renderToBuffer(
     const Vec3f &camPos, 
     const Vec3f &camTarget, 
     float fov, 
-    Vec3f *buffer
+    Vec3f *buffer,
+    const RenderSettings &settings = RenderSettings()
+);
+
+// 与 renderToBuffer 相同，但复用 cache 中上一帧的结果，完成后用本帧结果更新 cache
+void renderReprojected(
+    const std::vector<Sphere> &spheres,
+    const Vec3f &camPos,
+    const Vec3f &camTarget,
+    float fov,
+    Vec3f *buffer,
+    const RenderSettings &settings,
+    FrameCache &cache
 );
 
+// 按行带渲染并逐带推送给 sink，不分配整幅图像的缓冲区
+bool renderToSink(
+    const std::vector<Sphere> &spheres,
+    const Vec3f &camPos,
+    const Vec3f &camTarget,
+    float fov,
+    ImageSink &sink,
+    const RenderSettings &settings = RenderSettings()
+);
+
+// 测试 1~maxThreads 个线程的渲染耗时与加速比，并校验与单线程结果逐像素一致
+void report_thread_scaling(
+    const std::vector<Sphere> &spheres,
+    const Vec3f &camPos,
+    const Vec3f &camTarget,
+    float fov,
+    unsigned maxThreads,
+    const RenderSettings &settings
+);
+
+// 保存 OpenGL 顺序(自下而上)的缓冲区，内部按行带交给 PNG 流式编码器
 void save_frame(Vec3f* image, unsigned width, unsigned height, const char *outdir);
+bool save_buffer_png(const Vec3f* image, unsigned width, unsigned height, const char *filename);
+
+// 把逐像素统计中的一项(如 &RayStats::nodes)按对数刻度映射为伪彩色(黑-蓝-青-绿-黄-红)，经同一个 PNG 编码器写出
+bool save_stats_heatmap(const FrameStats &stats, uint64_t RayStats::*field, const char *filename);
+
+// 直接流式渲染一帧到 PNG，适用于超大分辨率的静帧
+void save_frame_streamed(
+    const std::vector<Sphere> &spheres,
+    const Vec3f &camPos,
+    const Vec3f &camTarget,
+    float fov,
+    const RenderSettings &settings,
+    const char *outdir
+);
 #endif
\ No newline at end of file
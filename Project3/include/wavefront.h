@@ -0,0 +1,27 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+#include <vector>
+#include "element.h"
+#include "trace.h"
+
+// 波前式(wavefront)光线跟踪
+// trace 对每条光线深度优先地递归，每次命中镜面/玻璃都立即生成反射与折射光线，访存跳跃。
+// 波前引擎把同一深度的所有光线放进 SoA 队列，按阶段批量处理：
+//   extend：整个队列做最近交点查询
+//   shade ：未命中累加背景，命中累加自发光，镜面/玻璃生成下一深度的光线，漫反射生成阴影光线
+//   shadow：整个阴影队列做遮挡查询，未被遮挡的累加光源贡献
+// 每条光线携带所属像素与路径吞吐量(权重)，像素颜色是所有路径贡献之和，
+// 与 trace 的递归结果只在浮点求和顺序上不同
+//
+// dirs[i] 为像素编号 firstPixel + i 的主光线方向(起点均为 orig)，结果写入 colors[i]；
+// 像素编号只用于光源采样播种，与 trace 使用的 LightSampler 相同
+void trace_wavefront(
+    const Vec3f &orig,
+    const std::vector<Vec3f> &dirs,
+    uint32_t firstPixel,
+    const std::vector<Sphere> &spheres,
+    Vec3f *colors,
+    const RenderSettings &settings
+);
+
+#endif
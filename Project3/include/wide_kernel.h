@@ -0,0 +1,121 @@
+#ifndef WIDE_KERNEL_H
+#define WIDE_KERNEL_H
+// 宽树遍历内核，仅由 wide_sse.cpp / wide_avx.cpp 包含
+// 与 packet_kernel.h 相同，内核位于匿名命名空间中，只读取原始指针与成员变量，叶子通过不内联的函数求交
+#include <cmath>
+#include <cstdint>
+#include "wide_tree.h"
+
+namespace {
+
+// 一条光线的 slab 测试参数：方向的倒数，以及每个轴上先进入的是下界(0)还是上界(1)
+// 按倒数的符号选择平面(而不是对两个距离取 min/max)，空位的 +INF / -INF 包围盒在任何方向上都得到 t_enter = +INF
+struct WideRay {
+    float orig[3], inv[3];
+    int nearSide[3];
+
+    explicit WideRay(const WideQuery& q) {
+        const float o[3] = {q.orig.x, q.orig.y, q.orig.z}, d[3] = {q.dir.x, q.dir.y, q.dir.z};
+        for (int a = 0; a < 3; ++a) {
+            orig[a] = o[a];
+            inv[a] = 1 / d[a];
+            nearSide[a] = std::signbit(inv[a]) ? 1 : 0;
+        }
+    }
+};
+
+// 远端距离放大 1 + 2 * gamma(3)，抵消乘以倒数带来的舍入误差，测试结果不会比精确运算更严格 (PBRT 3.9.2)
+constexpr float WIDE_FAR_SCALE = 1 + 2 * (3 * 0.5f * 1.1920929e-7f) / (1 - 3 * 0.5f * 1.1920929e-7f);
+
+// 节点 N 个子节点与 [0, tmax] 的 slab 测试，S::N 个子节点一组，返回命中掩码，t_enter 写入各子节点的入口距离
+// 方向分量为 0 且起点恰在平面上时距离为 NaN，max/min 把该轴的结果丢弃(SSE 的 max/min 在有 NaN 时返回第二个操作数)
+template<typename S, int N>
+inline unsigned wide_child_hits(const WideKDNode<N>& node, const WideRay& r, float tmax, float* t_enter) {
+    typedef typename S::F F;
+    unsigned mask = 0;
+    for (int c = 0; c < N; c += S::N) {
+        F tmin = S::zero(), tfar = S::set1(tmax);
+        for (int a = 0; a < 3; ++a) {
+            F o = S::set1(r.orig[a]), inv = S::set1(r.inv[a]);
+            F t0 = S::mul(S::sub(S::load(node.bounds[2 * a + r.nearSide[a]] + c), o), inv);
+            F t1 = S::mul(S::mul(S::sub(S::load(node.bounds[2 * a + 1 - r.nearSide[a]] + c), o), inv), S::set1(WIDE_FAR_SCALE));
+            tmin = S::max(t0, tmin);
+            tfar = S::min(t1, tfar);
+        }
+        S::store(t_enter + c, tmin);
+        mask |= unsigned(S::movemask(S::cmple(tmin, tfar))) << c;
+    }
+    return mask & ((1u << node.used) - 1);
+}
+
+// 栈中的一项：宽节点或原树的叶子，以及它的入口距离
+struct WideStackEntry {
+    uint32_t child;
+    uint16_t count; // 0 表示宽节点
+    uint8_t type;
+    float t_enter;
+};
+
+template<typename S, int N>
+void wide_traverse_nearest(const WideKDNode<N>* nodes, WideQuery& q) {
+    WideRay r(q);
+    // 每层最多净增 N - 1 项，宽树的深度不超过原树
+    WideStackEntry stack[KD_TRAVERSAL_STACK_SIZE * (N - 1) + 1];
+    int top = 0;
+    stack[top++] = {0, 0, 0, 0};
+    while (top > 0) {
+        WideStackEntry entry = stack[--top];
+        if (entry.t_enter > q.tmax) continue; // 已找到比入口更近的交点
+        if (entry.count > 0) {
+            wide_leaf_intersect(q, entry.child, entry.count, entry.type);
+            continue;
+        }
+        const WideKDNode<N>& node = nodes[entry.child];
+        RAY_STAT(nodes, 1);
+        RAY_STAT(boxes, N);
+
+        alignas(32) float t_enter[N];
+        unsigned mask = wide_child_hits<S, N>(node, r, q.tmax, t_enter);
+        // 命中的子节点按入口距离插入排序：远的先入栈，最近的位于栈顶
+        int first = top;
+        for (; mask != 0; mask &= mask - 1) {
+            int k = __builtin_ctz(mask);
+            WideStackEntry child = {node.child[k], node.count[k], node.type[k], t_enter[k]};
+            int j = top++;
+            while (j > first && stack[j - 1].t_enter < child.t_enter) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = child;
+        }
+    }
+}
+
+// 遮挡查询不需要排序，找到第一个遮挡物即返回
+template<typename S, int N>
+bool wide_traverse_occluded(const WideKDNode<N>* nodes, WideQuery& q) {
+    WideRay r(q);
+    WideStackEntry stack[KD_TRAVERSAL_STACK_SIZE * (N - 1) + 1];
+    int top = 0;
+    stack[top++] = {0, 0, 0, 0};
+    while (top > 0) {
+        WideStackEntry entry = stack[--top];
+        if (entry.count > 0) {
+            if (wide_leaf_occluded(q, entry.child, entry.count, entry.type)) return true;
+            continue;
+        }
+        const WideKDNode<N>& node = nodes[entry.child];
+        RAY_STAT(nodes, 1);
+        RAY_STAT(boxes, N);
+
+        alignas(32) float t_enter[N];
+        for (unsigned mask = wide_child_hits<S, N>(node, r, q.tmax, t_enter); mask != 0; mask &= mask - 1) {
+            int k = __builtin_ctz(mask);
+            stack[top++] = {node.child[k], node.count[k], node.type[k], t_enter[k]};
+        }
+    }
+    return false;
+}
+
+} // namespace
+#endif
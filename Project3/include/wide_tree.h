@@ -0,0 +1,124 @@
+#ifndef WIDE_TREE_H
+#define WIDE_TREE_H
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "./kd_tree.h"
+
+// 宽树节点(BVH4 / BVH8)：一个节点直接保存 N 个子节点的包围盒，按分量分开存放(SoA)，
+// 一次 SIMD slab 测试即可得到全部子节点的命中掩码与入口距离
+// 子节点可以是另一个宽节点，也可以直接是原树的叶子；N = 4 时 128 字节，N = 8 时 256 字节
+// 方向含 NaN 的光线在 SIMD max/min 下会“命中”所有子节点(与 AABB::intersect 相同)，空位必须按 used 排除，否则会把根节点(下标 0)再次入栈
+template<int N>
+struct alignas(32) WideKDNode {
+    float bounds[6][N];  // bounds[2 * axis] 为各子节点在 axis 轴上的下界，bounds[2 * axis + 1] 为上界；空位下界 +INF、上界 -INF，永远不会命中
+    uint32_t child[N];   // 内部子节点：宽节点下标；叶子：原树叶子在图元下标数组中的起点
+    uint16_t count[N];   // 叶子中的物体数，0 表示内部子节点
+    uint8_t type[N];     // 叶子的图元类型(LEAF_SPHERES / LEAF_TRIANGLES / LEAF_INSTANCES)
+    uint8_t used;        // 有效的子节点数，之后的空位不参与遍历(占用对齐的填充字节，节点大小不变)
+};
+
+// 由二叉的线性树折叠而成的宽树：只替换节点数组，叶子几何、图元下标与实例仍然使用原树(base)，
+// base 在其生命周期内不能修改
+template<int N>
+struct WideKDTree {
+    const LinearKDTree* base = nullptr;
+    std::vector<WideKDNode<N>> nodes;
+    int maxDepth = 0;
+
+    // 节点数事先未知，数组按倍增扩容，这里只计实际使用的节点
+    size_t memoryBytes() const { return nodes.size() * sizeof(WideKDNode<N>); }
+};
+
+// 把二叉节点 index 折叠为一个宽节点，返回其下标
+// 从两个子节点出发，反复把表面积最大(光线最可能进入)的内部子节点换成它的两个子节点，直到凑满 N 个或全部是叶子
+template<int N>
+inline uint32_t collapse_wide_node(const LinearKDTree& tree, uint32_t index, int depth, WideKDTree<N>& out) {
+    uint32_t children[N];
+    int n = 0;
+    const LinearKDNode& node = tree.nodes[index];
+    if (node.count > 0) {
+        children[n++] = index; // 整棵树只有一个叶子
+    } else {
+        children[n++] = index + 1;
+        children[n++] = node.offset;
+    }
+    while (n < N) {
+        int best = -1;
+        float bestArea = -1;
+        for (int k = 0; k < n; ++k) {
+            const LinearKDNode& c = tree.nodes[children[k]];
+            if (c.count == 0 && c.bbox.surfaceArea() > bestArea) best = k, bestArea = c.bbox.surfaceArea();
+        }
+        if (best < 0) break;
+        uint32_t expand = children[best];
+        children[best] = expand + 1;
+        children[n++] = tree.nodes[expand].offset;
+    }
+
+    uint32_t wideIndex = uint32_t(out.nodes.size());
+    out.nodes.emplace_back();
+    out.maxDepth = std::max(out.maxDepth, depth);
+    WideKDNode<N> wide;
+    for (int a = 0; a < 3; ++a) {
+        for (int k = 0; k < N; ++k) wide.bounds[2 * a][k] = INFINITY, wide.bounds[2 * a + 1][k] = -INFINITY;
+    }
+    for (int k = 0; k < N; ++k) wide.child[k] = 0, wide.count[k] = 0, wide.type[k] = LEAF_SPHERES;
+    wide.used = uint8_t(n);
+    for (int k = 0; k < n; ++k) {
+        const LinearKDNode& c = tree.nodes[children[k]];
+        for (int a = 0; a < 3; ++a) {
+            wide.bounds[2 * a][k] = axis_value(c.bbox.min, a);
+            wide.bounds[2 * a + 1][k] = axis_value(c.bbox.max, a);
+        }
+        if (c.count > 0) {
+            wide.child[k] = c.offset, wide.count[k] = c.count, wide.type[k] = c.axis;
+        } else {
+            wide.child[k] = collapse_wide_node(tree, children[k], depth + 1, out);
+        }
+    }
+    out.nodes[wideIndex] = wide; // 递归时数组可能重新分配，最后再写入
+    return wideIndex;
+}
+
+// 由线性树生成宽树，节点按深度优先顺序存放，根节点下标为 0
+template<int N>
+inline void build_wide_tree(const LinearKDTree& tree, WideKDTree<N>& out) {
+    TimelineScope scope("build wide tree", "build", "width", N);
+    out.base = &tree;
+    out.nodes.clear();
+    out.maxDepth = 0;
+    // 只有一个空叶子的树(没有图元)没有可遍历的节点
+    if (tree.nodes.empty() || (tree.nodes.size() == 1 && tree.nodes[0].count == 0)) return;
+    collapse_wide_node(tree, 0, 0, out);
+}
+
+// 一条光线在宽树上的查询状态
+// SIMD 内核只读取光线与 tmax，叶子求交交给 wide_sse.cpp 中不内联的 wide_leaf_intersect / wide_leaf_occluded，
+// 以免以 -mavx 编译的 wide_avx.cpp 生成 kd_tree.h 中内联函数的 AVX 版本，在链接时替换掉其他文件使用的副本
+struct WideQuery {
+    const LinearKDTree* tree;
+    Vec3f orig, dir;
+    WatertightRay wray;
+    NearestHit nearest;
+    float tmax;         // 最近交点查询中为当前最近距离，找到更近的交点时缩小
+    int32_t skipObject; // 遮挡查询忽略的物体
+
+    WideQuery(const LinearKDTree& tree, const Vec3f& orig, const Vec3f& dir, float tmax, int32_t skipObject = -1)
+        : tree(&tree), orig(orig), dir(dir), wray(orig, dir), tmax(tmax), skipObject(skipObject) {}
+};
+
+void wide_leaf_intersect(WideQuery& query, uint32_t offset, uint32_t count, uint8_t type);
+bool wide_leaf_occluded(WideQuery& query, uint32_t offset, uint32_t count, uint8_t type);
+
+// 宽树上的最近交点与遮挡查询，语义与 intersect_kd_tree / occluded_kd_tree 相同
+// 4 路节点用 SSE；8 路节点在支持 AVX 的 CPU 上用 AVX(wide_avx.cpp)，否则每个节点分两次 SSE 测试
+PrimHit intersect_wide_tree(const WideKDTree<4>& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear);
+PrimHit intersect_wide_tree(const WideKDTree<8>& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear);
+bool occluded_wide_tree(const WideKDTree<4>& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject = -1);
+bool occluded_wide_tree(const WideKDTree<8>& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject = -1);
+
+// AVX 版本的 8 路内核，只能在 supported_packet_width(8) == 8 时调用
+void wide_intersect8_avx(const WideKDNode<8>* nodes, WideQuery& query);
+bool wide_occluded8_avx(const WideKDNode<8>* nodes, WideQuery& query);
+#endif
@@ -0,0 +1,285 @@
+// 无窗口批量渲染：读取场景与相机路径，逐个位姿渲染并输出 PNG，
+// 打印每帧耗时与吞吐率(Mrays/s)，供无显示环境的渲染机使用
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+#include "element.h"
+#include "trace.h"
+#include "kd_tree.h"
+#include "scene.h"
+#include "timeline.h"
+
+LinearKDTree g_kdTree;
+
+// 转发给实际输出端并累计其耗时：流式渲染时 PNG 编码穿插在行带之间，
+// 从帧时间中扣除这部分，各种模式下报告的帧时间与 Mrays/s 都只包含渲染
+class TimedSink : public ImageSink
+{
+public:
+    explicit TimedSink(ImageSink& sink) : sink(sink) {}
+    bool begin(unsigned width, unsigned height) override { return timed([&] { return sink.begin(width, height); }); }
+    bool writeBand(unsigned y0, unsigned rowCount, const Vec3f* rows) override {
+        return timed([&] { return sink.writeBand(y0, rowCount, rows); });
+    }
+    bool end() override { return timed([&] { return sink.end(); }); }
+
+    double ms = 0;
+
+private:
+    ImageSink& sink;
+
+    template<typename Fn>
+    bool timed(const Fn& fn) {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = fn();
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+};
+
+static void usage(const char *prog) {
+    std::cerr << "用法: " << prog << " <scene.txt | default> <camera_path.txt> [选项]\n"
+              << "  --size W H      输出分辨率(默认 640 480)\n"
+              << "  --threads N     渲染线程数(默认全部硬件线程)\n"
+              << "  --tile N        分块边长(默认 32)\n"
+              << "  --packet N      主光线包宽度 1/4/8(默认 1，逐条跟踪)\n"
+              << "  --lights N      每个漫反射交点按功率采样 N 个光源(默认 0，计算全部光源)\n"
+              << "  --wide N        最近交点与遮挡查询遍历由二叉树折叠出的 4/8 路宽树(默认 0，二叉树；主光线包仍用二叉树)\n"
+              << "  --wavefront     使用波前引擎：按深度分批处理 SoA 光线队列\n"
+              << "  --no-sort       波前引擎中不对次级光线排序(用于对比)\n"
+              << "  --aa N          自适应反走样：边缘像素最多追加 N 个分层子采样(默认 0，关闭)\n"
+              << "  --aa-threshold T 相邻像素颜色差超过 T 时视为边缘(默认 0.1)\n"
+              << "  --reproject     复用上一帧结果，只重新跟踪空洞与误差较大的像素\n"
+              << "  --reproject-all 重投影时也复用反射/透明像素(更快，但有误差)\n"
+              << "  --animate DT    动画模式：第 i 帧的场景时间为 i * DT 秒，球体弹跳、光源环绕，每帧重新拟合加速树\n"
+              << "  --rebuild R     动画模式下树的平均 SAH 代价超过构建时的 R 倍则完整重建(默认 1.5)\n"
+              << "  --lod P         实例在画面上的直径不超过 P/2 像素时使用简化网格，每减半下降一级(默认 128，0 关闭)\n"
+              << "  --heatmap KIND  额外输出逐像素遍历开销热力图 pose_XXXX_KIND.png，KIND 为 nodes/leaves/boxes/prims/secondary/misses(需 make STATS=1)\n"
+              << "  --timeline FILE 把建树、分块渲染、trace 递归与 PNG 编码的时间线写为 Chrome trace JSON(可在 Perfetto 中打开)\n"
+              << "  --out DIR       输出目录(默认 ./output)\n"
+              << "  --median        使用按深度轮换轴的中位数划分建树(默认分箱 SAH，场景含网格时无效)\n"
+              << "  --sah Ct Ci     SAH 的遍历代价与求交代价(默认 1 1)\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    RenderSettings settings;
+    SAHParams sah;
+    bool median = false, reproject = false, animate = false;
+    float animateStep = 0, rebuildRatio = 1.5f;
+    unsigned wide = 0;
+    const char *outdir = "./output";
+    const char *heatmap = nullptr;
+    const char *timeline = nullptr;
+    for (int i = 3; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--size") == 0 && i + 2 < argc) settings.width = std::atoi(argv[++i]), settings.height = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) settings.threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc) settings.tileSize = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--packet") == 0 && i + 1 < argc) settings.packetWidth = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc) settings.lightSamples = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--wide") == 0 && i + 1 < argc) wide = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--wavefront") == 0) settings.wavefront = true;
+        else if (std::strcmp(argv[i], "--no-sort") == 0) settings.sortRays = false;
+        else if (std::strcmp(argv[i], "--aa") == 0 && i + 1 < argc) settings.aaSamples = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--aa-threshold") == 0 && i + 1 < argc) settings.aaThreshold = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--reproject") == 0) reproject = true;
+        else if (std::strcmp(argv[i], "--reproject-all") == 0) reproject = true, settings.reprojectViewDependent = true;
+        else if (std::strcmp(argv[i], "--animate") == 0 && i + 1 < argc) animate = true, animateStep = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--rebuild") == 0 && i + 1 < argc) rebuildRatio = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--lod") == 0 && i + 1 < argc) settings.lodPixels = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) timeline = argv[++i];
+        else if (std::strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) heatmap = argv[++i];
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) outdir = argv[++i];
+        else if (std::strcmp(argv[i], "--median") == 0) median = true;
+        else if (std::strcmp(argv[i], "--sah") == 0 && i + 2 < argc) sah.traversalCost = std::atof(argv[++i]), sah.intersectCost = std::atof(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (wide != 0 && wide != 4 && wide != 8) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (settings.wavefront && settings.aaSamples > 0) {
+        std::cerr << "--wavefront does not support --aa, rendering with per-pixel trace instead" << std::endl;
+    }
+
+    // 热力图统计的计数项
+    uint64_t RayStats::*heatmapField = nullptr;
+    FrameStats frameStats;
+    if (heatmap) {
+        const char *names[] = {"nodes", "leaves", "boxes", "prims", "secondary", "misses"};
+        uint64_t RayStats::*fields[] = {&RayStats::nodes, &RayStats::leaves, &RayStats::boxes, &RayStats::prims, &RayStats::secondary, &RayStats::misses};
+        for (int k = 0; k < 6; ++k) {
+            if (std::strcmp(heatmap, names[k]) == 0) heatmapField = fields[k];
+        }
+        if (!heatmapField) {
+            usage(argv[0]);
+            return 1;
+        }
+#ifndef RAY_STATS
+        std::cerr << "--heatmap requires a build with ray statistics (make clean && make STATS=1)" << std::endl;
+        return 1;
+#endif
+        if (settings.wavefront) {
+            std::cerr << "--heatmap does not support the wavefront engine" << std::endl;
+            return 1;
+        }
+        settings.stats = &frameStats;
+    }
+
+    // 输出目录在渲染前创建，路径不可用时直接报错，而不是渲染完第一帧才失败
+    std::error_code dirError;
+    std::filesystem::create_directories(outdir, dirError);
+    if (dirError) {
+        std::cerr << "Failed to create output directory " << outdir << ": " << dirError.message() << std::endl;
+        return 1;
+    }
+
+    if (timeline) timeline_start();
+    std::vector<Sphere> spheres;
+    TriangleMesh mesh;
+    InstanceSet instanceSet;
+    if (std::strcmp(argv[1], "default") == 0) default_scene(spheres);
+    else if (!load_scene(argv[1], spheres, &mesh, &instanceSet)) return 1;
+    if (median && (!mesh.triangles.empty() || !instanceSet.instances.empty())) {
+        std::cerr << "--median only supports spheres, using binned SAH" << std::endl;
+        median = false;
+    }
+    std::vector<CameraPose> poses;
+    if (!load_camera_path(argv[2], poses)) return 1;
+
+    // SAH 树由线程池并行原地构建；中位数划分仍经过指针树
+    auto buildStart = std::chrono::steady_clock::now();
+    TreeStats stats;
+    std::vector<LinearKDTree> objectTrees;
+    std::vector<TreeInstance> instances;
+    if (median) {
+        std::vector<const Sphere*> sphere_ptrs;
+        for (const auto& s : spheres) sphere_ptrs.push_back(&s);
+        KDNode* root = build_kd_tree(sphere_ptrs, 0);
+        flatten_kd_tree(root, spheres, g_kdTree);
+        stats = kd_tree_stats(root, sah);
+        delete root;
+    } else {
+        build_instances(instanceSet, objectTrees, instances, sah, &render_pool(settings.threads));
+        build_linear_tree(spheres, &mesh, &instances, g_kdTree, sah, &render_pool(settings.threads));
+    }
+    std::chrono::duration<double, std::milli> buildMs = std::chrono::steady_clock::now() - buildStart;
+    if (!median) stats = linear_tree_stats(g_kdTree, sah);
+    std::cout << "scene: " << spheres.size() << " spheres, " << mesh.triangles.size() << " triangles, " << g_kdTree.emitters.size() << " lights, build " << buildMs.count() << " ms, "
+              << poses.size() << " poses, " << settings.width << "x" << settings.height << std::endl;
+    std::cout << "tree (" << (median ? "median" : "binned SAH") << "): " << stats
+              << " memory=" << g_kdTree.memoryBytes() / 1024.0 << " KiB" << std::endl;
+    if (wide) {
+        auto wideStart = std::chrono::steady_clock::now();
+        size_t wideBytes = use_wide_tree(wide);
+        std::chrono::duration<double, std::milli> wideMs = std::chrono::steady_clock::now() - wideStart;
+        std::cout << "wide tree: " << wide << "-wide, collapse " << wideMs.count() << " ms, memory=" << wideBytes / 1024.0 << " KiB" << std::endl;
+    }
+    if (!instances.empty()) {
+        // 内存只随原型数增长：底层树各一棵，实例只保存变换与包围盒
+        size_t objectBytes = 0, placed = 0;
+        for (const auto& tree : objectTrees) objectBytes += tree.memoryBytes();
+        for (const auto& inst : instances) placed += inst.levels[0].sphereCount + inst.levels[0].triangleCount();
+        std::cout << "instances: " << instances.size() << " of " << instanceSet.prototypes.size() << " objects (" << placed << " placed primitives), object trees="
+                  << objectBytes / 1024.0 << " KiB, instance data=" << instances.size() * sizeof(TreeInstance) / 1024.0 << " KiB" << std::endl;
+        for (const Prototype& p : instanceSet.prototypes) {
+            if (p.lods.empty()) continue;
+            std::cout << "lod " << p.name << ": " << p.mesh.triangles.size();
+            for (const TriangleMesh& level : p.lods) std::cout << " -> " << level.triangles.size();
+            std::cout << " triangles" << std::endl;
+        }
+    }
+
+    double totalMs = 0, totalEncodeMs = 0;
+    uint64_t totalRays = 0;
+    FrameCache cache;
+    std::vector<Vec3f> image(reproject || heatmap ? size_t(settings.width) * settings.height : 0);
+    const std::vector<Sphere> rest = spheres;
+    size_t rebuilds = 0;
+    for (size_t i = 0; i < poses.size(); ++i) {
+        char filename[256];
+        std::snprintf(filename, sizeof(filename), "%s/pose_%04zu.png", outdir, i);
+        PngStreamWriter writer(filename);
+        TimedSink timedWriter(writer);
+
+        if (animate) {
+            // 球体原地移动，加速树自底向上重新拟合，质量下降过多时才重建(重建统一使用 SAH)
+            animate_scene(rest, i * animateStep, spheres);
+            auto updateStart = std::chrono::steady_clock::now();
+            bool rebuilt = update_linear_tree(spheres, g_kdTree, rebuildRatio, sah, &render_pool(settings.threads));
+            if (wide) use_wide_tree(wide); // 宽树复制了节点包围盒，随二叉树重新折叠
+            std::chrono::duration<double, std::milli> updateMs = std::chrono::steady_clock::now() - updateStart;
+            rebuilds += rebuilt;
+            std::cout << "frame " << i << ": " << (rebuilt ? "rebuild " : "refit ") << updateMs.count() << " ms, quality="
+                      << linear_tree_quality(g_kdTree) << " (built " << g_kdTree.builtCost << ")" << std::endl;
+            cache.clear(); // 场景已变化，上一帧的结果不能复用
+        }
+
+        // 帧时间只计渲染，PNG 编码单独计时
+        reset_ray_count();
+        auto start = std::chrono::steady_clock::now();
+        bool ok = true;
+        if (reproject) {
+            // 重投影需要整幅图像，渲染完成后再写出
+            renderReprojected(spheres, poses[i].pos, poses[i].target, poses[i].fov, image.data(), settings, cache);
+        } else if (heatmap) {
+            // 逐像素统计需要整幅图像的缓冲区
+            renderToBuffer(spheres, poses[i].pos, poses[i].target, poses[i].fov, image.data(), settings);
+        } else {
+            ok = renderToSink(spheres, poses[i].pos, poses[i].target, poses[i].fov, timedWriter, settings);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() - timedWriter.ms;
+        double encodeMs = timedWriter.ms;
+        uint64_t rays = ray_count();
+        if (reproject || heatmap) {
+            auto encodeStart = std::chrono::steady_clock::now();
+            ok = save_buffer_png(image.data(), settings.width, settings.height, filename);
+            encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+        }
+        if (reproject) std::cout << "frame " << i << ": retraced " << cache.retraced << " / " << image.size() << " pixels" << std::endl;
+        if (ok && heatmap) {
+            char heatname[256];
+            std::snprintf(heatname, sizeof(heatname), "%s/pose_%04zu_%s.png", outdir, i, heatmap);
+            ok = save_stats_heatmap(frameStats, heatmapField, heatname);
+            const RayStats &t = frameStats.totals;
+            double perRay = rays ? 1.0 / rays : 0;
+            std::cout << "frame " << i << ": " << heatname << " nodes=" << t.nodes << " leaves=" << t.leaves << " boxes=" << t.boxes
+                      << " prims=" << t.prims << " secondary=" << t.secondary << " misses=" << t.misses << " (per ray " << t.nodes * perRay
+                      << " / " << t.leaves * perRay << " / " << t.boxes * perRay << " / " << t.prims * perRay << " / " << t.misses * perRay << ")" << std::endl;
+        }
+        if (!ok) {
+            std::cerr << "Failed to save: " << filename << std::endl;
+            return 1;
+        }
+        totalMs += ms;
+        totalEncodeMs += encodeMs;
+        totalRays += rays;
+        std::cout << "frame " << i << ": " << filename << " " << ms << " ms, "
+                  << rays << " rays, " << rays / (ms * 1e3) << " Mrays/s, encode " << encodeMs << " ms";
+        if (!instances.empty()) {
+            // 本帧选中的细节层次下实际参与遍历的三角形数
+            size_t triangles = 0;
+            for (const auto& inst : instances) triangles += inst.object->triangleCount();
+            std::cout << ", " << triangles << " instanced triangles";
+        }
+        std::cout << std::endl;
+    }
+    if (!poses.empty()) {
+        std::cout << "total: " << totalMs << " ms, avg " << totalMs / poses.size() << " ms/frame, "
+                  << totalRays / (totalMs * 1e3) << " Mrays/s, encode " << totalEncodeMs << " ms";
+        if (animate) std::cout << ", " << rebuilds << " rebuilds";
+        std::cout << std::endl;
+    }
+    if (timeline && !timeline_stop(timeline)) return 1;
+    return 0;
+}
@@ -0,0 +1,288 @@
+// 加速结构基准测试：在随机球体场景上比较不同树布局的求交吞吐率
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "element.h"
+#include "kd_tree.h"
+#include "packet.h"
+#include "quantized_tree.h"
+#include "wide_tree.h"
+
+// 随机生成 n 个球体，分布在 [-extent, extent]^3 内
+static void random_spheres(size_t n, float extent, unsigned seed, std::vector<Sphere> &spheres) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pos(-extent, extent), radius(0.05f, 0.5f);
+    spheres.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        spheres.push_back(Sphere(Vec3f(pos(rng), pos(rng), pos(rng)), radius(rng), Vec3f(0.5f)));
+    }
+}
+
+// 光线从包围场景的球面射向场景内部的随机点
+struct Ray {
+    Vec3f orig, dir;
+};
+
+static void random_rays(size_t n, float extent, unsigned seed, std::vector<Ray> &rays) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pos(-extent, extent), unit(-1, 1);
+    rays.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        Vec3f o(unit(rng), unit(rng), unit(rng));
+        o.normalize();
+        o = o * (extent * 3);
+        Vec3f d = Vec3f(pos(rng), pos(rng), pos(rng)) - o;
+        d.normalize();
+        rays.push_back(Ray{o, d});
+    }
+}
+
+// 两棵线性树的节点、下标与叶子几何是否逐字节相同
+static bool same_tree(const LinearKDTree &a, const LinearKDTree &b) {
+    return a.nodes.size() == b.nodes.size() && a.blocks.size() == b.blocks.size() && a.primIndices == b.primIndices
+        && std::memcmp(a.nodes.data(), b.nodes.data(), a.nodes.size() * sizeof(LinearKDNode)) == 0
+        && std::memcmp(a.blocks.data(), b.blocks.data(), a.blocks.size() * sizeof(SphereBlock)) == 0;
+}
+
+template<typename Fn>
+static double time_ms(const Fn &fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    return ms.count();
+}
+
+// 对 rays 执行 intersect 并返回最短用时(ms)，hits 记录每条光线的命中球体
+template<typename Fn>
+static double time_traversal(const std::vector<Ray> &rays, std::vector<const Sphere*> &hits, const Fn &intersect) {
+    double best = INFINITY;
+    for (int rep = 0; rep < 3; ++rep) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rays.size(); ++i) {
+            float tnear = INFINITY;
+            hits[i] = intersect(rays[i].orig, rays[i].dir, tnear);
+        }
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        best = std::min(best, ms.count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t numSpheres = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    size_t numRays = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200000;
+    unsigned threads = argc > 3 ? std::atoi(argv[3]) : 0; // 并行构建的线程数，0 表示全部硬件线程
+    float extent = std::cbrt(float(numSpheres)) * 0.5f; // 保持球体密度大致不变，绝大多数光线会命中球体
+
+    std::vector<Sphere> spheres;
+    std::vector<Ray> rays;
+    random_spheres(numSpheres, extent, 1, spheres);
+    random_rays(numRays, extent, 2, rays);
+
+    // 构建：指针树 + 线性化，与原地构建(串行/并行)比较，三者应逐字节相同
+    KDNode* root = nullptr;
+    LinearKDTree tree, serialTree, parallelTree;
+    double pointerBuildMs = time_ms([&] {
+        std::vector<const Sphere*> sphere_ptrs;
+        for (const auto& s : spheres) sphere_ptrs.push_back(&s);
+        root = build_sah_tree(sphere_ptrs, SAHParams());
+        flatten_kd_tree(root, spheres, tree);
+    });
+    double serialBuildMs = time_ms([&] { build_linear_tree(spheres, serialTree); });
+    WorkStealingPool pool(threads);
+    double parallelBuildMs = time_ms([&] { build_linear_tree(spheres, parallelTree, SAHParams(), &pool); });
+    bool sameTree = same_tree(tree, serialTree) && same_tree(tree, parallelTree);
+    std::cout << "spheres=" << numSpheres << " rays=" << numRays << " " << kd_tree_stats(root) << std::endl;
+    std::cout << "build: pointer+flatten " << pointerBuildMs << " ms, in-place " << serialBuildMs << " ms, parallel ("
+              << pool.size() << " threads) " << parallelBuildMs << " ms, trees " << (sameTree ? "identical" : "DIFFER") << std::endl;
+    serialTree.clear();
+    parallelTree.clear();
+    std::cout << "node bytes: pointer=" << sizeof(KDNode) << " linear=" << sizeof(LinearKDNode) << " quantized=" << sizeof(QuantizedKDNode)
+              << " wide4=" << sizeof(WideKDNode<4>) << " wide8=" << sizeof(WideKDNode<8>) << std::endl;
+
+    std::vector<const Sphere*> ref(numRays), hits(numRays);
+    double pointerMs = time_traversal(rays, ref, [&](const Vec3f &o, const Vec3f &d, float &t) {
+        return intersect_kd_tree(root, o, d, t);
+    });
+    double linearMs = time_traversal(rays, hits, [&](const Vec3f &o, const Vec3f &d, float &t) {
+        return intersect_kd_tree(tree, o, d, t).sphere;
+    });
+    bool match = sameTree && ref == hits;
+
+    std::cout << "pointer tree: " << pointerMs << " ms, " << numRays / (pointerMs * 1e3) << " Mrays/s" << std::endl;
+    std::cout << "linear tree:  " << linearMs << " ms, " << numRays / (linearMs * 1e3) << " Mrays/s, speedup "
+              << pointerMs / linearMs << "x, hits " << (match ? "match" : "DIFFER") << std::endl;
+    delete root;
+
+    // 量化节点：随机方向的光线几乎每次访问节点都缺失缓存，吞吐率主要取决于节点数组能否留在缓存中；
+    // 遮挡查询到最近交点为止，逐个访问这一段上的全部节点，不会提前结束
+    QuantizedKDTree qtree;
+    bool quantized = false;
+    double quantizeMs = time_ms([&] { quantized = quantize_linear_tree(tree, qtree); });
+    // 遮挡查询截止到线性树的最近交点(交点距离严格小于 tmax 才算遮挡，最近的球体本身不计入)
+    std::vector<float> refDist(numRays);
+    for (size_t i = 0; i < numRays; ++i) {
+        refDist[i] = INFINITY;
+        intersect_kd_tree(tree, rays[i].orig, rays[i].dir, refDist[i]);
+    }
+    std::vector<uint8_t> refShadow(numRays), shadow(numRays);
+    auto timeShadow = [&](std::vector<uint8_t> &out, const auto &occluded) {
+        double best = INFINITY;
+        for (int rep = 0; rep < 3; ++rep) {
+            best = std::min(best, time_ms([&] {
+                for (size_t i = 0; i < numRays; ++i) out[i] = occluded(rays[i].orig, rays[i].dir, refDist[i]);
+            }));
+        }
+        return best;
+    };
+    double linearShadowMs = timeShadow(refShadow, [&](const Vec3f &o, const Vec3f &d, float t) { return occluded_kd_tree(tree, o, d, t); });
+    std::cout << "linear nodes:      " << tree.nodes.size() * sizeof(LinearKDNode) / 1024.0 << " KiB, nearest " << numRays / (linearMs * 1e3)
+              << " Mrays/s, occlusion " << numRays / (linearShadowMs * 1e3) << " Mrays/s" << std::endl;
+    // 与线性树逐条精确比较最近命中的球体与遮挡结果，不一致的光线数单独成行(与实例化的比较相同)：
+    // 远处的小球体上 Sphere::intersect 的单精度舍入可能对擦过的光线报告命中，放大的包围盒会让这类光线进入叶子，
+    // 线性树的精确包围盒则把它挡在外面(200 万个球体、20 万条光线中约 1 条)，因此不计入退出码
+    auto reportTree = [&](const char *name, size_t bytes, double ms, double shadowMs) {
+        size_t differ = 0;
+        for (size_t i = 0; i < numRays; ++i) differ += hits[i] != ref[i] || shadow[i] != refShadow[i];
+        std::cout << name << bytes / 1024.0 << " KiB (" << tree.nodes.size() * sizeof(LinearKDNode) / double(bytes) << "x smaller), nearest "
+                  << numRays / (ms * 1e3) << " Mrays/s (" << linearMs / ms << "x), occlusion " << numRays / (shadowMs * 1e3) << " Mrays/s ("
+                  << linearShadowMs / shadowMs << "x), hits " << (differ == 0 ? "match" : "DIFFER") << std::endl;
+        std::cout << "  " << differ << " of " << numRays << " rays differ from the linear tree" << std::endl;
+    };
+    if (quantized) {
+        std::cout << "quantize: " << quantizeMs << " ms" << std::endl;
+        double qMs = time_traversal(rays, hits, [&](const Vec3f &o, const Vec3f &d, float &t) { return intersect_quantized_tree(qtree, o, d, t).sphere; });
+        double qShadowMs = timeShadow(shadow, [&](const Vec3f &o, const Vec3f &d, float t) { return occluded_quantized_tree(qtree, o, d, t); });
+        reportTree("quantized nodes:   ", qtree.memoryBytes(), qMs, qShadowMs);
+    } else {
+        std::cout << "quantized nodes:   skipped, a leaf holds more than 16383 objects" << std::endl;
+    }
+
+    // 宽树：一次 SIMD 测试覆盖一个节点的全部子节点，深度约为二叉树的 1/2(4 路)与 1/3(8 路)
+    WideKDTree<4> wide4;
+    WideKDTree<8> wide8;
+    double wideBuildMs = time_ms([&] { build_wide_tree(tree, wide4), build_wide_tree(tree, wide8); });
+    std::cout << "wide collapse: " << wideBuildMs << " ms, depth linear=" << linear_tree_stats(tree).maxDepth << " wide4=" << wide4.maxDepth
+              << " wide8=" << wide8.maxDepth << ", 8-wide kernel " << (supported_packet_width(8) == 8 ? "AVX" : "2x SSE") << std::endl;
+    double w4Ms = time_traversal(rays, hits, [&](const Vec3f &o, const Vec3f &d, float &t) { return intersect_wide_tree(wide4, o, d, t).sphere; });
+    double w4ShadowMs = timeShadow(shadow, [&](const Vec3f &o, const Vec3f &d, float t) { return occluded_wide_tree(wide4, o, d, t); });
+    reportTree("wide4 nodes:       ", wide4.memoryBytes(), w4Ms, w4ShadowMs);
+    double w8Ms = time_traversal(rays, hits, [&](const Vec3f &o, const Vec3f &d, float &t) { return intersect_wide_tree(wide8, o, d, t).sphere; });
+    double w8ShadowMs = timeShadow(shadow, [&](const Vec3f &o, const Vec3f &d, float t) { return occluded_wide_tree(wide8, o, d, t); });
+    reportTree("wide8 nodes:       ", wide8.memoryBytes(), w8Ms, w8ShadowMs);
+
+    // 主光线包：相机位于场景外，按 4x2 像素块生成相干光线
+    const unsigned width = 640, height = 480;
+    Vec3f camPos(0, 0, extent * 3);
+    float angle = std::tan(M_PI * 0.5 * 40 / 180.), aspect = width / float(height);
+    std::vector<float> pdx(width * height), pdy(width * height), pdz(width * height);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            // 4x2 块内的像素在数组中连续存放，便于直接按包读取
+            size_t i = ((y / 2) * (width / 4) + x / 4) * 8 + (y % 2) * 4 + x % 4;
+            Vec3f d((2 * ((x + 0.5f) / width) - 1) * angle * aspect, (1 - 2 * ((y + 0.5f) / height)) * angle, -1);
+            d.normalize();
+            pdx[i] = d.x, pdy[i] = d.y, pdz[i] = d.z;
+        }
+    }
+    std::vector<int32_t> scalarHits(width * height), packetHits(width * height);
+    auto timePrimary = [&](unsigned packetWidth, std::vector<int32_t> &out) {
+        double best = INFINITY;
+        for (int rep = 0; rep < 3; ++rep) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t base = 0; base < out.size(); base += 8) {
+                for (size_t sub = 0; sub < 8; sub += packetWidth) {
+                    size_t i = base + sub;
+                    RayPacket packet;
+                    packet.orig = camPos;
+                    for (unsigned k = 0; k < packetWidth; ++k) {
+                        packet.dx[k] = pdx[i + k], packet.dy[k] = pdy[i + k], packet.dz[k] = pdz[i + k];
+                        packet.tnear[k] = INFINITY;
+                        packet.hit[k] = -1;
+                    }
+                    packet.active = (1u << packetWidth) - 1;
+                    if (packetWidth > 1 && intersect_packet(tree, packet, packetWidth)) {
+                        for (unsigned k = 0; k < packetWidth; ++k) out[i + k] = packet.hit[k];
+                        continue;
+                    }
+                    for (unsigned k = 0; k < packetWidth; ++k) {
+                        float t = INFINITY;
+                        out[i + k] = hit_object(tree, intersect_kd_tree(tree, camPos, Vec3f(pdx[i + k], pdy[i + k], pdz[i + k]), t));
+                    }
+                }
+            }
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+            best = std::min(best, ms.count());
+        }
+        return best;
+    };
+
+    double scalarMs = timePrimary(1, scalarHits);
+    std::cout << "primary scalar:   " << scalarMs << " ms, " << width * height / (scalarMs * 1e3) << " Mrays/s" << std::endl;
+    for (unsigned w : {4u, 8u}) {
+        if (supported_packet_width(w) != w) {
+            std::cout << "primary packet" << w << ": not supported on this CPU" << std::endl;
+            continue;
+        }
+        double ms = timePrimary(w, packetHits);
+        bool same = packetHits == scalarHits;
+        match = match && same;
+        std::cout << "primary packet" << w << ":  " << ms << " ms, " << width * height / (ms * 1e3) << " Mrays/s, speedup "
+                  << scalarMs / ms << "x, hits " << (same ? "match" : "DIFFER") << std::endl;
+    }
+
+    // 实例化：同一个 1000 个球体的原型随机旋转后放置多份，与展开成普通球体的同一场景比较
+    const size_t perObject = 1000;
+    size_t copies = std::max<size_t>(1, numSpheres / perObject);
+    unsigned side = (unsigned)std::ceil(std::cbrt(double(copies)));
+    float spacing = 2 * extent / side, scale = spacing / (std::cbrt(float(perObject)) * 1.2f);
+    InstanceSet set;
+    set.prototypes.resize(1);
+    random_spheres(perObject, std::cbrt(float(perObject)) * 0.5f, 3, set.prototypes[0].spheres);
+    std::vector<Sphere> flat;
+    for (size_t k = 0; k < copies; ++k) {
+        Vec3f offset(-extent + spacing * (k % side + 0.5f), -extent + spacing * (k / side % side + 0.5f), -extent + spacing * (k / side / side + 0.5f));
+        Transform toWorld = Transform::place(offset, scale, float(k * 37 % 360));
+        set.instances.push_back(Instance{0, toWorld});
+        for (const Sphere &s : set.prototypes[0].spheres) flat.push_back(Sphere(toWorld.point(s.center), s.radius * scale, s.surfaceColor));
+    }
+    LinearKDTree flatTree, instancedTree;
+    std::vector<LinearKDTree> objectTrees;
+    std::vector<TreeInstance> instances;
+    double flatBuildMs = time_ms([&] { build_linear_tree(flat, flatTree, SAHParams(), &pool); });
+    double instancedBuildMs = time_ms([&] {
+        build_instances(set, objectTrees, instances, SAHParams(), &pool);
+        build_linear_tree(std::vector<Sphere>(), nullptr, &instances, instancedTree, SAHParams(), &pool);
+    });
+    size_t instancedBytes = instancedTree.memoryBytes() + objectTrees[0].memoryBytes() + instances.size() * sizeof(TreeInstance);
+    std::vector<float> flatDist(numRays), instancedDist(numRays);
+    auto timeDistances = [&](const LinearKDTree &t, std::vector<float> &dist) {
+        double best = INFINITY;
+        for (int rep = 0; rep < 3; ++rep) {
+            best = std::min(best, time_ms([&] {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    dist[i] = INFINITY;
+                    intersect_kd_tree(t, rays[i].orig, rays[i].dir, dist[i]);
+                }
+            }));
+        }
+        return best;
+    };
+    double flatMs = timeDistances(flatTree, flatDist), instancedMs = timeDistances(instancedTree, instancedDist);
+    // 光线变换到物体空间后舍入不同，擦边光线可能由命中变为错过(或反之)而落到后面的球体上，允许少量差异
+    size_t differ = 0;
+    for (size_t i = 0; i < numRays; ++i) {
+        differ += std::isinf(flatDist[i]) != std::isinf(instancedDist[i])
+               || (!std::isinf(flatDist[i]) && std::abs(flatDist[i] - instancedDist[i]) > 1e-3f * std::max(1.0f, flatDist[i]));
+    }
+    std::cout << "instancing: " << copies << " copies of " << perObject << " spheres" << std::endl;
+    std::cout << "  flat:      build " << flatBuildMs << " ms, memory " << flatTree.memoryBytes() / 1024.0 << " KiB, "
+              << numRays / (flatMs * 1e3) << " Mrays/s" << std::endl;
+    std::cout << "  instanced: build " << instancedBuildMs << " ms, memory " << instancedBytes / 1024.0 << " KiB, "
+              << numRays / (instancedMs * 1e3) << " Mrays/s, " << differ << " of " << numRays << " hits differ" << std::endl;
+    return match ? 0 : 1;
+}
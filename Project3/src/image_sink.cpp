@@ -0,0 +1,168 @@
+#include "image_sink.h"
+#include <algorithm>
+#include <cstdlib>
+#include <zlib.h>
+#include "timeline.h"
+
+struct PngStreamWriter::Deflater {
+    z_stream stream = z_stream();
+    bool ok;
+
+    Deflater() { ok = deflateInit(&stream, Z_DEFAULT_COMPRESSION) == Z_OK; }
+    ~Deflater() {
+        if (ok) deflateEnd(&stream);
+    }
+};
+
+static void put_u32_be(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+PngStreamWriter::PngStreamWriter(std::string filename) : filename(std::move(filename)) {}
+
+PngStreamWriter::~PngStreamWriter() {
+    if (file) fclose(file);
+}
+
+// 写入失败时释放压缩流并删除不完整的文件，总是返回 false
+bool PngStreamWriter::discard() {
+    deflater.reset();
+    if (file) {
+        fclose(file);
+        file = nullptr;
+        std::remove(filename.c_str());
+    }
+    return false;
+}
+
+bool PngStreamWriter::writeChunk(const char type[4], const unsigned char* data, size_t size) {
+    unsigned char header[8] = {
+        (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size,
+        (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3]
+    };
+    uLong crc = crc32(0, header + 4, 4);
+    if (size > 0) crc = crc32(crc, data, uInt(size)); // crc32 对空指针返回初始值而不是原样返回 crc
+    unsigned char footer[4] = {
+        (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc
+    };
+    return fwrite(header, 1, 8, file) == 8
+        && (size == 0 || fwrite(data, 1, size, file) == size)
+        && fwrite(footer, 1, 4, file) == 4;
+}
+
+bool PngStreamWriter::begin(unsigned w, unsigned h) {
+    discard(); // 上一次未完成的输出
+    file = fopen(filename.c_str(), "wb");
+    if (!file) return false;
+    width = w, height = h, rowsWritten = 0;
+    prevRow.assign(size_t(width) * 3, 0); // 第一行的上一行视为全 0
+    deflater.reset(new Deflater());
+    if (!deflater->ok) return discard();
+
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (fwrite(signature, 1, 8, file) != 8) return discard();
+
+    // IHDR：宽、高、8 位深度、RGB、默认压缩/滤波、无隔行
+    std::vector<unsigned char> ihdr;
+    put_u32_be(ihdr, width);
+    put_u32_be(ihdr, height);
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+    return writeChunk("IHDR", ihdr.data(), ihdr.size()) || discard();
+}
+
+bool PngStreamWriter::writeBand(unsigned y0, unsigned rowCount, const Vec3f* rows) {
+    if (!file || !deflater || y0 != rowsWritten || y0 + rowCount > height) return false;
+
+    // 每行前加滤波类型字节，滤波所需的上一行跨行带保存在 prevRow 中
+    size_t rowBytes = size_t(width) * 3 + 1;
+    raw.resize(rowBytes * rowCount);
+    {
+        TimelineScope convert("png convert", "io", "rows", rowCount);
+        curRow.resize(size_t(width) * 3);
+        for (unsigned y = 0; y < rowCount; ++y) {
+            unsigned char* dst = curRow.data();
+            for (unsigned x = 0; x < width; ++x) {
+                const Vec3f& c = rows[size_t(y) * width + x];
+                *dst++ = to_byte(c.x);
+                *dst++ = to_byte(c.y);
+                *dst++ = to_byte(c.z);
+            }
+            filterRow(&raw[y * rowBytes]);
+            prevRow.swap(curRow);
+        }
+    }
+    TimelineScope encode("png encode", "io", "rows", rowCount);
+    rowsWritten += rowCount;
+    return deflateChunk(raw.data(), raw.size(), Z_NO_FLUSH) || discard();
+}
+
+// 与 stb_image_write 相同的启发式：对五种滤波分别计算结果(按有符号字节)的绝对值之和，取最小者
+void PngStreamWriter::filterRow(unsigned char* out) {
+    const size_t n = curRow.size();
+    const unsigned char* cur = curRow.data();
+    const unsigned char* up = prevRow.data();
+    filtered.resize(n);
+    long bestSum = 0;
+    for (int type = 0; type < 5; ++type) {
+        // 不滤波的结果直接写入 out，其余先写入 filtered，更好时再复制
+        unsigned char* dst = type == 0 ? out + 1 : filtered.data();
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            int a = i >= 3 ? cur[i - 3] : 0, b = up[i], c = i >= 3 ? up[i - 3] : 0;
+            int pred = 0;
+            if (type == 1) pred = a;
+            else if (type == 2) pred = b;
+            else if (type == 3) pred = (a + b) >> 1;
+            else if (type == 4) {
+                int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                pred = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            }
+            unsigned char v = (unsigned char)(cur[i] - pred);
+            dst[i] = v;
+            sum += std::abs((signed char)v);
+        }
+        if (type == 0) {
+            bestSum = sum;
+            out[0] = 0;
+        } else if (sum < bestSum) {
+            bestSum = sum;
+            out[0] = (unsigned char)type;
+            std::copy(filtered.begin(), filtered.end(), out + 1);
+        }
+    }
+}
+
+// 把 size 字节送入 deflate，产生的压缩数据写成一个 IDAT 块(没有输出时不写)
+// Z_NO_FLUSH 时 zlib 可能把尾部数据留在内部窗口中，随下一个行带或 end 中的 Z_FINISH 一起输出
+bool PngStreamWriter::deflateChunk(const unsigned char* data, size_t size, int flush) {
+    z_stream& stream = deflater->stream;
+    chunk.resize(deflateBound(&stream, uLong(size)) + 64);
+    stream.next_in = const_cast<unsigned char*>(data);
+    stream.avail_in = uInt(size);
+    size_t produced = 0;
+    for (;;) {
+        stream.next_out = chunk.data() + produced;
+        stream.avail_out = uInt(chunk.size() - produced);
+        int ret = deflate(&stream, flush);
+        if (ret == Z_STREAM_ERROR) return false;
+        produced = chunk.size() - stream.avail_out;
+        if (stream.avail_out > 0 && stream.avail_in == 0 && (flush != Z_FINISH || ret == Z_STREAM_END)) break;
+        chunk.resize(chunk.size() * 2);
+    }
+    return produced == 0 || writeChunk("IDAT", chunk.data(), produced);
+}
+
+bool PngStreamWriter::end() {
+    if (!file || !deflater || rowsWritten != height) return false;
+
+    // 输出 zlib 内部剩余的数据与 Adler32，结束 deflate 流
+    if (!deflateChunk(nullptr, 0, Z_FINISH) || !writeChunk("IEND", nullptr, 0)) return discard();
+    deflater.reset();
+    bool ok = fclose(file) == 0;
+    file = nullptr;
+    if (!ok) std::remove(filename.c_str());
+    return ok;
+}
@@ -2,33 +2,110 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include "element.h"
 #include "trace.h"
 #include "kd_tree.h"
+#include "scene.h"
+#include "timeline.h"
 
 unsigned g_width = 640;
 unsigned g_height = 480;
 std::vector<Sphere> g_spheres;
-KDNode* g_kdRoot = nullptr;
+TriangleMesh g_mesh;
+InstanceSet g_instanceSet;                 // 场景文件中的原型与实例
+std::vector<LinearKDTree> g_objectTrees;   // 每个原型一棵底层树
+std::vector<TreeInstance> g_instances;     // 顶层树中的实例
+LinearKDTree g_kdTree;
 Vec3f* g_imageBuffer = nullptr;
 const char *outdir = "./output";
+const char *g_timelinePath = nullptr; // --timeline：从启动到退出记录各阶段的时间线
 
 // 相机交互参数
 Vec3f g_camPos(0, 0, 5);      // 相机位置
 Vec3f g_camTarget(0, 0, -20); // 观察目标点
 float g_fov = 30.0f;          // 视场角
+RenderSettings g_settings;    // 渲染线程数与分块大小
+unsigned g_wide = 0;          // --wide：最近交点与遮挡查询遍历 4/8 路宽树，0 使用二叉树
 
-// 将 Vec3f 缓冲区转换为 OpenGL 可用的像素字节流
-void updateDisplayBuffer() {
-    renderToBuffer(g_spheres, g_camPos, g_camTarget, g_fov, g_imageBuffer);
+// 渐进式细化：相机变化后先以 1/8 分辨率渲染并立即显示，再依次细化到 1/4、1/2 和全分辨率
+unsigned g_levels = 4;                // 细化级数，1 表示直接渲染全分辨率
+unsigned g_nextLevel = 0;             // 下一个待渲染的级别，等于 g_levels 时已完成
+unsigned g_shownScale = 1;            // 当前显示图像的降采样倍数
+Vec3f* g_previewBuffer = nullptr;     // 低分辨率级别的渲染结果，全分辨率直接写入 g_imageBuffer
+
+// 时域重投影：相机小步移动时复用上一帧全分辨率结果，只重新跟踪空洞与误差较大的像素
+bool g_reproject = false;
+FrameCache g_frameCache;
+
+// 动画模式：每完成一帧全分辨率渲染后推进时间，按 animate_scene 移动球体并重新拟合层次结构
+bool g_animate = false;
+bool g_animPaused = false;
+float g_animTime = 0;
+float g_animStep = 1.0f / 30;         // 每帧推进的时间(秒)
+float g_rebuildRatio = 1.5f;          // 树的平均 SAH 代价超过构建时的该倍数时完整重建
+std::vector<Sphere> g_restSpheres;    // 动画的初始状态
+
+unsigned levelScale(unsigned level) {
+    return 1u << (g_levels - 1 - level);
+}
+
+// 渲染第 level 级：降采样倍数为 s 时以 ceil(W/s) x ceil(H/s) 渲染，宽高比保持与窗口一致
+void renderLevel(unsigned level) {
+    unsigned scale = levelScale(level);
+    if (scale == 1) {
+        if (g_reproject) renderReprojected(g_spheres, g_camPos, g_camTarget, g_fov, g_imageBuffer, g_settings, g_frameCache);
+        else renderToBuffer(g_spheres, g_camPos, g_camTarget, g_fov, g_imageBuffer, g_settings);
+    } else {
+        RenderSettings preview = g_settings;
+        preview.width = (g_width + scale - 1) / scale;
+        preview.height = (g_height + scale - 1) / scale;
+        preview.aspect = g_width / float(g_height);
+        renderToBuffer(g_spheres, g_camPos, g_camTarget, g_fov, g_previewBuffer, preview);
+    }
+    g_shownScale = scale;
+}
+
+// 空闲时每次渲染一个级别并刷新显示，期间到来的输入会在两个级别之间被处理
+void idle() {
+    if (g_nextLevel >= g_levels) {
+        if (!g_animate || g_animPaused) {
+            glutIdleFunc(nullptr); // 已细化到全分辨率，停止空转
+            return;
+        }
+        // 推进动画：物体移动后上一帧的重投影缓存失效，直接渲染全分辨率，避免低分辨率预览闪烁
+        g_animTime += g_animStep;
+        animate_scene(g_restSpheres, g_animTime, g_spheres);
+        update_linear_tree(g_spheres, g_kdTree, g_rebuildRatio, SAHParams(), &render_pool(g_settings.threads));
+        if (g_wide) use_wide_tree(g_wide);
+        g_frameCache.clear();
+        g_nextLevel = g_levels - 1;
+    }
+    renderLevel(g_nextLevel++);
+    glutPostRedisplay();
+}
+
+// 相机变化：从最粗的级别重新开始细化；已有可重投影的上一帧时直接渲染全分辨率
+void restartRefinement() {
+    g_nextLevel = (g_reproject && g_frameCache.width > 0) ? g_levels - 1 : 0;
+    glutIdleFunc(idle);
 }
 
 void display() {
     glClear(GL_COLOR_BUFFER_BIT);
 
-    // 将渲染好的图像绘制到屏幕
-    // g_imageBuffer 存储的是 0-255 的 unsigned char RGB 数据
-    glDrawPixels(g_width, g_height, GL_RGB, GL_FLOAT, g_imageBuffer);
+    // 将渲染好的图像绘制到屏幕，低分辨率级别用 glPixelZoom 放大到窗口大小
+    if (g_shownScale > 1) {
+        unsigned scale = g_shownScale;
+        glPixelZoom(scale, scale);
+        TimelineScope scope("glDrawPixels", "display", "scale", scale);
+        glDrawPixels((g_width + scale - 1) / scale, (g_height + scale - 1) / scale, GL_RGB, GL_FLOAT, g_previewBuffer);
+        glPixelZoom(1, 1);
+    } else {
+        TimelineScope scope("glDrawPixels", "display");
+        glDrawPixels(g_width, g_height, GL_RGB, GL_FLOAT, g_imageBuffer);
+    }
 
     glutSwapBuffers();
 }
@@ -45,43 +122,115 @@ void keyboard(unsigned char key, int x, int y) {
         case 'f': g_camPos.y -= step; break; // 下移
         case 'z': g_fov = std::max(5.0f, g_fov - 1.0f); break; // 缩小 FOV
         case 'x': g_fov = std::min(120.0f, g_fov + 1.0f); break; // 扩大 FOV
-        case 'c': save_frame(g_imageBuffer, g_width, g_height, outdir); break;
+        case ' ':
+            // 暂停/继续动画
+            if (!g_animate) return;
+            g_animPaused = !g_animPaused;
+            if (!g_animPaused) glutIdleFunc(idle);
+            return;
+        case 'c':
+            // 保存前确保全分辨率图像已渲染完成
+            if (g_nextLevel < g_levels) {
+                renderLevel(g_levels - 1);
+                g_nextLevel = g_levels;
+                glutPostRedisplay();
+            }
+            save_frame(g_imageBuffer, g_width, g_height, outdir);
+            return;
         case 27:
             exit(0);
             break; // ESC 键退出
+        default:
+            return;
         }
     // 触发重新渲染
-    updateDisplayBuffer();
-    glutPostRedisplay();
+    restartRefinement();
 }
 
-void initScene() {
-    g_spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.2), 0, 0.0));
-    g_spheres.push_back(Sphere(Vec3f(0.0, 0, -20), 4, Vec3f(1.00, 0.32, 0.36), 1, 0.5)); 
-    g_spheres.push_back(Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0));
-    g_spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
-    g_spheres.push_back(Sphere(Vec3f(-5.5, 0, -15), 3, Vec3f(0.90, 0.90, 0.90), 1, 0.0));
-    // 光源
-    g_spheres.push_back(Sphere(Vec3f(0.0, 20, -30), 3, Vec3f(0), 0, 0.0, Vec3f(1)));
+bool initScene(const char *scenePath) {
+    if (!scenePath) default_scene(g_spheres);
+    else if (!load_scene(scenePath, g_spheres, &g_mesh, &g_instanceSet)) return false;
     g_imageBuffer = new Vec3f[g_width * g_height];
+    g_previewBuffer = new Vec3f[((g_width + 1) / 2) * ((g_height + 1) / 2)];
+    return true;
 }
 
 int main(int argc, char** argv) {
+    // 命令行参数：--size W H 窗口分辨率，--threads N 渲染线程数，--tile N 分块大小，--packet N 主光线包宽度，
+    // --lights N 每个漫反射交点采样的光源数，--wide N 最近交点与遮挡查询遍历 4/8 路宽树，
+    // --levels N 渐进式细化级数(默认 4，即 1/8 -> 全分辨率，1 表示关闭)，
+    // --reproject 开启时域重投影，--aa N 自适应反走样的子采样数上限，--wavefront 使用波前引擎，
+    // --animate DT 动画模式(每帧推进 DT 秒)，--rebuild R 平均 SAH 代价超过构建时的 R 倍时重建层次结构，
+    // --scaling N 输出 1~N 线程的加速比后直接退出(无需窗口)，--scene FILE 从场景文件读取球体、网格与实例，
+    // --lod P 实例在画面上不超过 P/2 像素时使用简化网格(默认 128，0 关闭)，
+    // --still W H 以任意分辨率流式渲染一帧 PNG 到 output 后退出，
+    // --timeline FILE 把建树、分块渲染、PNG 编码与 glDrawPixels 等阶段的时间线写为 Chrome trace JSON(退出时写出)
+    unsigned scalingThreads = 0, stillWidth = 0, stillHeight = 0;
+    bool scaling = false;
+    const char *scenePath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--size") == 0 && i + 2 < argc) g_width = std::atoi(argv[++i]), g_height = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--still") == 0 && i + 2 < argc) stillWidth = std::atoi(argv[++i]), stillHeight = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) g_settings.threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc) g_settings.tileSize = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--packet") == 0 && i + 1 < argc) g_settings.packetWidth = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc) g_settings.lightSamples = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--wide") == 0 && i + 1 < argc) g_wide = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--levels") == 0 && i + 1 < argc) g_levels = std::max(1, std::min(4, std::atoi(argv[++i])));
+        else if (std::strcmp(argv[i], "--reproject") == 0) g_reproject = true;
+        else if (std::strcmp(argv[i], "--wavefront") == 0) g_settings.wavefront = true;
+        else if (std::strcmp(argv[i], "--aa") == 0 && i + 1 < argc) g_settings.aaSamples = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--animate") == 0 && i + 1 < argc) g_animate = true, g_animStep = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--rebuild") == 0 && i + 1 < argc) g_rebuildRatio = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--scaling") == 0 && i + 1 < argc) scaling = true, scalingThreads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc) scenePath = argv[++i];
+        else if (std::strcmp(argv[i], "--lod") == 0 && i + 1 < argc) g_settings.lodPixels = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) g_timelinePath = argv[++i];
+    }
+    g_settings.width = g_width;
+    g_settings.height = g_height;
+    if (g_wide != 0 && g_wide != 4 && g_wide != 8) {
+        std::cerr << "--wide must be 4 or 8, using the binary tree instead" << std::endl;
+        g_wide = 0;
+    }
+    if (g_settings.wavefront && g_settings.aaSamples > 0) {
+        std::cerr << "--wavefront does not support --aa, rendering with per-pixel trace instead" << std::endl;
+    }
+
+    if (g_timelinePath) {
+        // ESC 通过 exit() 退出 GLUT 主循环，因此在 atexit 中写出
+        timeline_start();
+        std::atexit([] { timeline_stop(g_timelinePath); });
+    }
+    if (!initScene(scenePath)) return 1;
+    build_instances(g_instanceSet, g_objectTrees, g_instances, SAHParams(), &render_pool(g_settings.threads));
+    build_linear_tree(g_spheres, &g_mesh, &g_instances, g_kdTree, SAHParams(), &render_pool(g_settings.threads));
+    if (g_wide) use_wide_tree(g_wide);
+    if (g_animate) g_restSpheres = g_spheres;
+
+    if (scaling) {
+        report_thread_scaling(g_spheres, g_camPos, g_camTarget, g_fov, scalingThreads, g_settings);
+        return 0;
+    }
+    if (stillWidth > 0 && stillHeight > 0) {
+        RenderSettings still = g_settings;
+        still.width = stillWidth;
+        still.height = stillHeight;
+        save_frame_streamed(g_spheres, g_camPos, g_camTarget, g_fov, still, outdir);
+        return 0;
+    }
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
     glutInitWindowSize(g_width, g_height);
     glutCreateWindow("Ray Tracing Interactive Camera");
 
-    initScene();
-    std::vector<const Sphere*> sphere_ptrs;
-    for (const auto& s : g_spheres) sphere_ptrs.push_back(&s);
-    g_kdRoot = build_kd_tree(sphere_ptrs, 0);
-
-    updateDisplayBuffer(); // 初次渲染
+    restartRefinement(); // 初次渲染
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
 
     std::cout << "控制方式: W/S 前后, A/D 左右, R/F 上下, Z/X 缩放, C 保存渲染图" << std::endl;
+    if (g_animate) std::cout << "动画模式: 空格 暂停/继续" << std::endl;
 
     glutMainLoop();
     return 0;
@@ -0,0 +1,143 @@
+#include "mesh.h"
+#include <filesystem>
+#include <map>
+#include <utility>
+#include <meshark/mesh-io.h>
+#include <meshark/mesh-simplifier.h>
+
+// 索引三角形(corners 每 3 个一组)追加到 mesh：顶点先缩放 scale 倍再平移 offset
+static void append_triangles(const std::vector<Vec3f> &objectPositions, const std::vector<uint32_t> &corners,
+                             const Vec3f &offset, float scale, const Material &material, TriangleMesh &mesh) {
+    std::vector<Vec3f> positions(objectPositions.size());
+    for (size_t i = 0; i < positions.size(); ++i) positions[i] = objectPositions[i] * scale + offset;
+
+    // 叉积的模长是三角形面积的两倍，直接累加即按面积加权
+    std::vector<Vec3f> normals(positions.size(), Vec3f(0));
+    for (size_t i = 0; i < corners.size(); i += 3) {
+        const Vec3f &a = positions[corners[i]], &b = positions[corners[i + 1]], &c = positions[corners[i + 2]];
+        Vec3f n = (b - a).cross(c - a);
+        for (int k = 0; k < 3; ++k) normals[corners[i + k]] += n;
+    }
+    for (Vec3f &n : normals) n.normalize();
+
+    uint32_t materialIndex = (uint32_t)mesh.materials.size();
+    mesh.materials.push_back(material);
+    mesh.triangles.reserve(mesh.triangles.size() + corners.size() / 3);
+    for (size_t i = 0; i < corners.size(); i += 3) {
+        Triangle t;
+        t.v0 = positions[corners[i]], t.v1 = positions[corners[i + 1]], t.v2 = positions[corners[i + 2]];
+        t.n0 = normals[corners[i]], t.n1 = normals[corners[i + 1]], t.n2 = normals[corners[i + 2]];
+        // 相邻面法线相互抵消的顶点退回使用面法线
+        Vec3f face = (t.v1 - t.v0).cross(t.v2 - t.v0).normalize();
+        for (Vec3f *n : {&t.n0, &t.n1, &t.n2}) {
+            if (n->length2() == 0) *n = face;
+        }
+        t.material = materialIndex;
+        mesh.triangles.push_back(t);
+    }
+}
+
+// MeshSimplifier 只能处理封闭的三角形流形(构建半边结构时遇到重复的有向边会断言失败)：
+// 每个面都是三角形、每条有向边只出现一次且存在反向边、每个顶点都被引用
+static bool closed_triangle_manifold(const meshark::WavefrontObj &obj) {
+    std::map<std::pair<int, int>, int> directed;
+    std::vector<bool> used(obj.positions.size(), false);
+    for (size_t f = 0; f + 1 < obj.face_splits.size(); ++f) {
+        int begin = obj.face_splits[f], end = obj.face_splits[f + 1];
+        if (end - begin != 3) return false;
+        for (int k = begin; k < end; ++k) {
+            int a = obj.face_vertices[k].v, b = obj.face_vertices[k + 1 < end ? k + 1 : begin].v;
+            if (++directed[{a, b}] > 1) return false;
+            used[a] = true;
+        }
+    }
+    for (const auto &edge : directed) {
+        if (!directed.count({edge.first.second, edge.first.first})) return false;
+    }
+    for (bool u : used) {
+        if (!u) return false;
+    }
+    return true;
+}
+
+// 读取 OBJ 的顶点与三角形(多边形面按扇形拆分：(a, b, c, d, ...) 拆为 (a, b, c)、(a, c, d)、...)
+static std::unique_ptr<meshark::WavefrontObj> read_obj_triangles(const std::string &path, std::vector<Vec3f> &positions, std::vector<uint32_t> &corners) {
+    std::unique_ptr<meshark::WavefrontObj> obj = meshark::readWavefrontObj(path);
+    if (!obj) return nullptr;
+
+    positions.resize(obj->positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        const glm::vec3 &p = obj->positions[i];
+        positions[i] = Vec3f(p.x, p.y, p.z);
+    }
+    corners.clear();
+    for (size_t f = 0; f + 1 < obj->face_splits.size(); ++f) {
+        int begin = obj->face_splits[f], end = obj->face_splits[f + 1];
+        for (int k = begin + 1; k + 1 < end; ++k) {
+            int index[3] = {obj->face_vertices[begin].v, obj->face_vertices[k].v, obj->face_vertices[k + 1].v};
+            for (int v : index) {
+                if (v < 0 || size_t(v) >= positions.size()) {
+                    std::cerr << path << ": face " << f + 1 << " references missing vertex " << v + 1 << std::endl;
+                    return nullptr;
+                }
+                corners.push_back(uint32_t(v));
+            }
+        }
+    }
+    return obj;
+}
+
+// 可简化时返回 obj 对应的半边网格，否则返回空
+static std::unique_ptr<meshark::GeometryMesh> simplifiable_mesh(const std::string &path, const meshark::WavefrontObj &obj) {
+    if (!closed_triangle_manifold(obj)) {
+        std::cerr << path << ": not a closed triangle mesh, cannot simplify" << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<meshark::GeometryMesh> geometry(new meshark::GeometryMesh());
+    geometry->buildFromWavefrontObj(obj);
+    return geometry;
+}
+
+bool load_obj_mesh(const std::string &path, const Vec3f &offset, float scale, const Material &material, TriangleMesh &mesh,
+                   std::vector<TriangleMesh> *lods, float lodRatio) {
+    std::vector<Vec3f> positions;
+    std::vector<uint32_t> corners;
+    std::unique_ptr<meshark::WavefrontObj> obj = read_obj_triangles(path, positions, corners);
+    if (!obj) return false;
+    append_triangles(positions, corners, offset, scale, material, mesh);
+    if (!lods || lods->empty()) return true;
+
+    // 细节层次链：第 k 级优先读取同目录下预先简化好的 name.lodk.obj，否则在上一级的基础上继续边折叠，
+    // 保留约 lodRatio 的边；无法简化或已经很小的网格在后续各级中保持不变
+    std::unique_ptr<meshark::GeometryMesh> geometry = simplifiable_mesh(path, *obj);
+    std::string stem = path.substr(0, path.size() - std::filesystem::path(path).extension().string().size());
+    for (size_t k = 0; k < lods->size(); ++k) {
+        std::string cached = stem + ".lod" + std::to_string(k + 1) + ".obj";
+        std::vector<Vec3f> levelPositions;
+        std::vector<uint32_t> levelCorners;
+        std::unique_ptr<meshark::WavefrontObj> levelObj;
+        if (std::filesystem::exists(cached) && (levelObj = read_obj_triangles(cached, levelPositions, levelCorners))) {
+            positions.swap(levelPositions);
+            corners.swap(levelCorners);
+            geometry = simplifiable_mesh(cached, *levelObj);
+        } else if (geometry && geometry->numFaces() >= 64) {
+            // runSimplify 每折叠一条边打印一行，简化期间丢弃标准输出
+            std::streambuf *out = std::cout.rdbuf(nullptr);
+            meshark::MeshSimplifier(*geometry).runSimplify(lodRatio);
+            std::cout.rdbuf(out);
+            std::cout.clear();
+
+            positions.resize(geometry->numVertices());
+            for (meshark::Vertex v : geometry->vertices()) {
+                const glm::vec3 &p = geometry->pos(v);
+                positions[geometry->index(v)] = Vec3f(p.x, p.y, p.z);
+            }
+            corners.clear();
+            for (meshark::Face f : geometry->faces()) {
+                for (meshark::HalfEdge h : f->boundaryHalfEdges()) corners.push_back(uint32_t(geometry->index(h->tail)));
+            }
+        }
+        append_triangles(positions, corners, offset, scale, material, (*lods)[k]);
+    }
+    return true;
+}
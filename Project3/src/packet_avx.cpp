@@ -0,0 +1,15 @@
+// AVX 8 路光线包遍历，本文件单独以 -mavx 编译，只能在 supported_packet_width 确认支持后调用
+#include "packet.h"
+
+#if defined(__AVX__)
+#include "simd_avx.h"
+#include "packet_kernel.h"
+
+bool intersect_packet8(const LinearKDNode* nodes, const uint32_t* prims, const SphereBlock* blocks, RayPacket& packet) {
+    return packet_traverse<SimdAVX>(nodes, prims, blocks, packet);
+}
+#else
+bool intersect_packet8(const LinearKDNode*, const uint32_t*, const SphereBlock*, RayPacket&) {
+    return false;
+}
+#endif
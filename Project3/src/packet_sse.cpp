@@ -0,0 +1,39 @@
+// SSE 4 路光线包遍历，以及按 CPU 支持情况选择包宽度的分发逻辑
+#include "packet.h"
+
+#if defined(__SSE2__)
+#include "simd_sse.h"
+#include "packet_kernel.h"
+
+bool intersect_packet4(const LinearKDNode* nodes, const uint32_t* prims, const SphereBlock* blocks, RayPacket& packet) {
+    return packet_traverse<SimdSSE>(nodes, prims, blocks, packet);
+}
+#else
+bool intersect_packet4(const LinearKDNode*, const uint32_t*, const SphereBlock*, RayPacket&) {
+    return false;
+}
+#endif
+
+unsigned supported_packet_width(unsigned requested) {
+#if defined(__SSE2__)
+    if (requested >= 8) {
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx")) return 8;
+#endif
+        return 4;
+    }
+    return requested >= 4 ? 4 : 1;
+#else
+    (void)requested;
+    return 1;
+#endif
+}
+
+bool intersect_packet(const LinearKDTree& tree, RayPacket& packet, unsigned width) {
+    if (tree.nodes.empty()) return true;
+    // 包遍历只实现了球体叶子，含三角形或实例的树逐条求交
+    if (!tree.triIndices.empty() || !tree.instIndices.empty()) return false;
+    if (width == 8) return intersect_packet8(tree.nodes.data(), tree.primIndices.data(), tree.blocks.data(), packet);
+    if (width == 4) return intersect_packet4(tree.nodes.data(), tree.primIndices.data(), tree.blocks.data(), packet);
+    return false;
+}
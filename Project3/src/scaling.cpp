@@ -0,0 +1,351 @@
+// 场景规模基准测试：程序化生成 10^2 ~ 10^7 个球体的场景(均匀分布、聚簇分布、大地面、一半镜面)，
+// 对每个场景报告建树耗时、树与帧缓冲的内存、主光线/阴影光线/次级光线的吞吐率、渲染的线程扩展性，
+// 以及波前引擎中次级光线与阴影光线重排前后的耗时与遍历统计，
+// 结果同时写入 JSON 文件，便于在不同提交之间比较
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "element.h"
+#include "kd_tree.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#ifndef GIT_COMMIT
+#define GIT_COMMIT "unknown"
+#endif
+
+LinearKDTree g_kdTree;
+
+// 程序化场景：最后一个球体是光源，相机看向 target
+struct BenchScene {
+    std::string kind;
+    std::vector<Sphere> spheres;
+    Vec3f camPos, target;
+    float fov = 45;
+};
+
+// 场景的球体数为 n(含光源)，球体密度与 bench 相同，规模变化时画面中可见的球体大小不变
+static void make_scene(const std::string &kind, size_t n, BenchScene &scene) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(-1, 1), radius(0.05f, 0.5f);
+    scene.kind = kind;
+    scene.spheres.clear();
+    scene.spheres.reserve(n);
+    size_t count = n - 1;
+    float extent = std::cbrt(float(count)) * 0.5f;
+    if (kind == "uniform" || kind == "mirror") {
+        // mirror：分布与 uniform 相同，但每隔一个球体是镜面，大部分主光线会派生多层反射光线
+        for (size_t i = 0; i < count; ++i) {
+            float reflectivity = kind == "mirror" && i % 2 == 0 ? 1.0f : 0.0f;
+            scene.spheres.push_back(Sphere(Vec3f(unit(rng), unit(rng), unit(rng)) * extent, radius(rng), Vec3f(0.5f), reflectivity));
+        }
+    } else if (kind == "clustered") {
+        // 每簇约 1000 个球体，簇心均匀分布，簇内按正态分布聚集：树的上层稀疏、下层密集
+        size_t clusters = std::max<size_t>(1, count / 1000);
+        std::vector<Vec3f> centers(clusters);
+        for (Vec3f &c : centers) c = Vec3f(unit(rng), unit(rng), unit(rng)) * extent;
+        std::normal_distribution<float> spread(0, std::max(1.0f, extent * 0.05f));
+        for (size_t i = 0; i < count; ++i) {
+            const Vec3f &c = centers[i % clusters];
+            scene.spheres.push_back(Sphere(c + Vec3f(spread(rng), spread(rng), spread(rng)), radius(rng), Vec3f(0.5f)));
+        }
+    } else {
+        // 大地面：一个半径 10000 的球体的包围盒覆盖整个场景，其余球体散布并贴合在地面(球面)上
+        const float ground = 10000;
+        extent = std::sqrt(float(count)) * 0.6f;
+        scene.spheres.push_back(Sphere(Vec3f(0, -ground, 0), ground, Vec3f(0.2f)));
+        for (size_t i = 1; i < count; ++i) {
+            float r = radius(rng), x = unit(rng) * extent, z = unit(rng) * extent;
+            float y = std::sqrt(ground * ground - x * x - z * z) - ground + r;
+            scene.spheres.push_back(Sphere(Vec3f(x, y, z), r, Vec3f(0.5f), 0.5f));
+        }
+    }
+    scene.spheres.push_back(Sphere(Vec3f(0, extent * 2, 0), std::max(1.0f, extent * 0.1f), Vec3f(0), 0, 0, Vec3f(3)));
+    scene.target = Vec3f(0);
+    scene.camPos = kind == "ground" ? Vec3f(0, extent * 0.6f, extent * 1.5f) : Vec3f(0, 0, extent * 3);
+}
+
+// 一组光线：起点、方向与最远距离(阴影光线为到光源的距离)
+struct RaySet {
+    std::vector<Vec3f> orig, dir;
+    std::vector<float> tmax;
+    void add(const Vec3f &o, const Vec3f &d, float t = INFINITY) {
+        orig.push_back(o), dir.push_back(d), tmax.push_back(t);
+    }
+};
+
+template<typename Fn>
+static double time_ms(const Fn &fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    return ms.count();
+}
+
+// 多次执行取最短用时，返回 Mrays/s
+template<typename Fn>
+static double best_mrays(size_t rays, int repeats, const Fn &fn) {
+    double best = INFINITY;
+    for (int i = 0; i < repeats; ++i) best = std::min(best, time_ms(fn));
+    return rays > 0 ? rays / (best * 1e3) : 0;
+}
+
+struct ThreadResult {
+    unsigned threads;
+    double buildMs, frameMs, mrays;
+};
+
+// 波前引擎渲染一帧(renderToBuffer 把整帧作为一个波前)，光线重排开启与关闭时各阶段的开销
+struct SortResult {
+    WavefrontStats sorted, unsorted;
+};
+
+struct SceneResult {
+    std::string kind;
+    size_t primitives = 0;
+    double buildMs = 0;
+    size_t treeBytes = 0, sceneBytes = 0, framebufferBytes = 0;
+    TreeStats stats;
+    size_t primaryRays = 0, shadowRays = 0, secondaryRays = 0;
+    double primaryMrays = 0, shadowMrays = 0, secondaryMrays = 0;
+    std::vector<ThreadResult> scaling;
+    SortResult sort;
+};
+
+// 单线程测量三类光线的遍历吞吐率：主光线为整幅画面的相机光线，
+// 阴影光线从主光线交点射向光源中心(any-hit)，次级光线为交点处的镜面反射方向(最近交点，相干性差)
+static void measure_rays(const BenchScene &scene, unsigned width, unsigned height, int repeats, SceneResult &result) {
+    RaySet primary, shadow, secondary;
+    Vec3f w = scene.camPos - scene.target;
+    w.normalize();
+    Vec3f u = Vec3f(0, 1, 0).cross(w).normalize(), v = w.cross(u);
+    float angle = std::tan(float(M_PI) * 0.5f * scene.fov / 180), aspect = width / float(height);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            float xx = (2 * ((x + 0.5f) / width) - 1) * angle * aspect, yy = (1 - 2 * ((y + 0.5f) / height)) * angle;
+            Vec3f d = u * xx + v * yy - w;
+            primary.add(scene.camPos, d.normalize());
+        }
+    }
+
+    const Sphere &light = scene.spheres.back();
+    int32_t lightId = int32_t(scene.spheres.size() - 1);
+    std::vector<PrimHit> hits(primary.orig.size());
+    std::vector<float> tnear(primary.orig.size());
+    for (size_t i = 0; i < hits.size(); ++i) {
+        tnear[i] = INFINITY;
+        hits[i] = intersect_kd_tree(g_kdTree, primary.orig[i], primary.dir[i], tnear[i]);
+        if (!hits[i] || hit_object(g_kdTree, hits[i]) == lightId) continue;
+        Vec3f phit = primary.orig[i] + primary.dir[i] * tnear[i], normal;
+        Material material;
+        hit_surface(g_kdTree, hits[i], phit, normal, material);
+        if (normal.dot(primary.dir[i]) > 0) normal = -normal;
+        Vec3f origin = phit + normal * 1e-4f, toLight = light.center - origin;
+        float dist = toLight.length();
+        shadow.add(origin, toLight / dist, dist);
+        secondary.add(origin, primary.dir[i] - normal * 2 * primary.dir[i].dot(normal));
+    }
+
+    result.primaryRays = primary.orig.size(), result.shadowRays = shadow.orig.size(), result.secondaryRays = secondary.orig.size();
+    size_t sink = 0; // 防止编译器优化掉结果
+    result.primaryMrays = best_mrays(primary.orig.size(), repeats, [&] {
+        for (size_t i = 0; i < primary.orig.size(); ++i) {
+            float t = INFINITY;
+            sink += bool(intersect_kd_tree(g_kdTree, primary.orig[i], primary.dir[i], t));
+        }
+    });
+    result.shadowMrays = best_mrays(shadow.orig.size(), repeats, [&] {
+        for (size_t i = 0; i < shadow.orig.size(); ++i) sink += occluded_kd_tree(g_kdTree, shadow.orig[i], shadow.dir[i], shadow.tmax[i], lightId);
+    });
+    result.secondaryMrays = best_mrays(secondary.orig.size(), repeats, [&] {
+        for (size_t i = 0; i < secondary.orig.size(); ++i) {
+            float t = INFINITY;
+            sink += bool(intersect_kd_tree(g_kdTree, secondary.orig[i], secondary.dir[i], t));
+        }
+    });
+    if (sink == size_t(-1)) std::cout << sink;
+}
+
+// 波前引擎分别开启与关闭光线重排渲染同一帧，各取次级与阴影阶段总耗时最短的一次
+// 遍历的节点与叶子数与光线顺序无关，两者应相同；以 RAY_STATS 编译时模拟缓存的缺失次数反映重排带来的局部性
+static void measure_sorting(const BenchScene &scene, RenderSettings settings, int repeats, SortResult &result) {
+    settings.wavefront = true;
+    std::vector<Vec3f> frame(size_t(settings.width) * settings.height);
+    for (int sorted = 0; sorted < 2; ++sorted) {
+        settings.sortRays = sorted != 0;
+        WavefrontStats &best = sorted ? result.sorted : result.unsorted;
+        double bestMs = INFINITY;
+        for (int k = 0; k < repeats; ++k) {
+            WavefrontStats stats;
+            settings.wavefrontStats = &stats;
+            renderToBuffer(scene.spheres, scene.camPos, scene.target, scene.fov, frame.data(), settings);
+            if (stats.secondaryMs + stats.shadowMs < bestMs) bestMs = stats.secondaryMs + stats.shadowMs, best = stats;
+        }
+    }
+}
+
+static void print_sorting(const SortResult &r) {
+    const WavefrontStats &s = r.sorted, &u = r.unsorted;
+    std::cout << "  wavefront sorted/unsorted: secondary " << s.secondaryMs << " / " << u.secondaryMs << " ms (" << s.secondaryRays
+              << " rays), shadow " << s.shadowMs << " / " << u.shadowMs << " ms (" << s.shadowRays << " rays), sort " << s.sortMs << " ms" << std::endl;
+#ifdef RAY_STATS
+    auto perRay = [](uint64_t v, uint64_t rays) { return rays > 0 ? double(v) / rays : 0.0; };
+    auto line = [&](const char *name, const RayStats &a, const RayStats &b, uint64_t rays) {
+        std::cout << "    per " << name << " ray sorted/unsorted: nodes " << perRay(a.nodes, rays) << " / " << perRay(b.nodes, rays)
+                  << ", leaves " << perRay(a.leaves, rays) << " / " << perRay(b.leaves, rays)
+                  << ", cache misses " << perRay(a.misses, rays) << " / " << perRay(b.misses, rays) << std::endl;
+    };
+    line("secondary", s.secondary, u.secondary, s.secondaryRays);
+    line("shadow", s.shadow, u.shadow, s.shadowRays);
+#endif
+}
+
+static void write_json(std::ostream &out, const std::vector<SceneResult> &results, unsigned width, unsigned height) {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    out << "{\n  \"commit\": \"" << GIT_COMMIT << "\",\n  \"date\": \"" << date << "\",\n"
+        << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+        << "  \"width\": " << width << ",\n  \"height\": " << height << ",\n  \"scenes\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SceneResult &r = results[i];
+        out << (i ? "," : "") << "\n    {\"kind\": \"" << r.kind << "\", \"primitives\": " << r.primitives
+            << ", \"build_ms\": " << r.buildMs << ", \"tree_bytes\": " << r.treeBytes << ", \"scene_bytes\": " << r.sceneBytes
+            << ", \"framebuffer_bytes\": " << r.framebufferBytes
+            << ", \"nodes\": " << r.stats.nodes << ", \"leaves\": " << r.stats.leaves << ", \"depth\": " << r.stats.maxDepth << ", \"sah\": " << r.stats.sahCost
+            << ",\n     \"rays\": {\"primary\": " << r.primaryRays << ", \"shadow\": " << r.shadowRays << ", \"secondary\": " << r.secondaryRays << "}"
+            << ", \"mrays\": {\"primary\": " << r.primaryMrays << ", \"shadow\": " << r.shadowMrays << ", \"secondary\": " << r.secondaryMrays << "}"
+            << ",\n     \"wavefront\": {";
+        for (int sorted = 1; sorted >= 0; --sorted) {
+            const WavefrontStats &w = sorted ? r.sort.sorted : r.sort.unsorted;
+            out << (sorted ? "\"sorted\"" : ", \"unsorted\"") << ": {\"secondary_rays\": " << w.secondaryRays << ", \"secondary_ms\": " << w.secondaryMs
+                << ", \"shadow_rays\": " << w.shadowRays << ", \"shadow_ms\": " << w.shadowMs << ", \"sort_ms\": " << w.sortMs
+#ifdef RAY_STATS
+                << ", \"secondary_nodes\": " << w.secondary.nodes << ", \"secondary_leaves\": " << w.secondary.leaves << ", \"secondary_misses\": " << w.secondary.misses
+                << ", \"shadow_nodes\": " << w.shadow.nodes << ", \"shadow_leaves\": " << w.shadow.leaves << ", \"shadow_misses\": " << w.shadow.misses
+#endif
+                << "}";
+        }
+        out << "}"
+            << ",\n     \"threads\": [";
+        for (size_t k = 0; k < r.scaling.size(); ++k) {
+            const ThreadResult &t = r.scaling[k];
+            out << (k ? ", " : "") << "{\"threads\": " << t.threads << ", \"build_ms\": " << t.buildMs << ", \"frame_ms\": " << t.frameMs
+                << ", \"mrays\": " << t.mrays << "}";
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+static void usage(const char *prog) {
+    std::cerr << "用法: " << prog << " [选项]\n"
+              << "  --min N         最小图元数(默认 100)\n"
+              << "  --max N         最大图元数(默认 10000000)，规模从 min 起每次乘 10\n"
+              << "  --scenes LIST   逗号分隔的场景类型 uniform,clustered,ground,mirror(默认全部)\n"
+              << "  --size W H      主光线与渲染的分辨率(默认 640 480)\n"
+              << "  --threads N     线程扩展性测试的最大线程数(默认全部硬件线程)，按 1, 2, 4, ... 测试\n"
+              << "  --repeat N      每项计时重复 N 次取最短(默认 3)\n"
+              << "  --json FILE     结果写入 JSON 文件(默认 scaling.json)\n";
+}
+
+int main(int argc, char** argv) {
+    size_t minPrims = 100, maxPrims = 10000000;
+    unsigned width = 640, height = 480, maxThreads = 0;
+    int repeats = 3;
+    std::string scenes = "uniform,clustered,ground,mirror";
+    const char *jsonPath = "scaling.json";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--min") == 0 && i + 1 < argc) minPrims = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--max") == 0 && i + 1 < argc) maxPrims = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--scenes") == 0 && i + 1 < argc) scenes = argv[++i];
+        else if (std::strcmp(argv[i], "--size") == 0 && i + 2 < argc) width = std::atoi(argv[++i]), height = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) maxThreads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeats = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) jsonPath = argv[++i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (maxThreads == 0) maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    RenderSettings settings;
+    settings.width = width, settings.height = height;
+    std::vector<SceneResult> results;
+    BenchScene scene;
+    size_t start = 0;
+    while (start <= scenes.size()) {
+        size_t comma = scenes.find(',', start);
+        std::string kind = scenes.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? scenes.size() + 1 : comma + 1;
+        if (kind != "uniform" && kind != "clustered" && kind != "ground" && kind != "mirror") {
+            std::cerr << "unknown scene kind: " << kind << std::endl;
+            return 1;
+        }
+        for (size_t n = std::max<size_t>(minPrims, 2); n <= maxPrims; n *= 10) {
+            make_scene(kind, n, scene);
+            SceneResult r;
+            r.kind = kind, r.primitives = n;
+
+            // 各线程数下分别建树与渲染，最后一次建树的结果用于下面的光线测试(任意线程数下的树逐字节相同)；
+            // 树在场景之间重新创建，内存统计不包含之前更大场景留下的容量
+            g_kdTree = LinearKDTree();
+            for (unsigned threads : threadCounts) {
+                ThreadResult t;
+                t.threads = threads;
+                t.buildMs = time_ms([&] { build_linear_tree(scene.spheres, g_kdTree, SAHParams(), &render_pool(threads)); });
+                settings.threads = threads;
+                std::vector<Vec3f> frame(size_t(width) * height);
+                renderToBuffer(scene.spheres, scene.camPos, scene.target, scene.fov, frame.data(), settings); // 预热
+                double best = INFINITY;
+                uint64_t rays = 0;
+                for (int k = 0; k < repeats; ++k) {
+                    reset_ray_count();
+                    best = std::min(best, time_ms([&] { renderToBuffer(scene.spheres, scene.camPos, scene.target, scene.fov, frame.data(), settings); }));
+                    rays = ray_count();
+                }
+                t.frameMs = best, t.mrays = rays / (best * 1e3);
+                r.scaling.push_back(t);
+            }
+            r.buildMs = r.scaling[0].buildMs;
+            r.treeBytes = g_kdTree.memoryBytes();
+            r.sceneBytes = scene.spheres.size() * sizeof(Sphere);
+            r.framebufferBytes = size_t(width) * height * sizeof(Vec3f);
+            r.stats = linear_tree_stats(g_kdTree);
+            measure_rays(scene, width, height, repeats, r);
+            measure_sorting(scene, settings, repeats, r.sort);
+
+            std::cout << kind << " n=" << n << ": build " << r.buildMs << " ms, tree " << r.treeBytes / 1048576.0 << " MiB, scene "
+                      << r.sceneBytes / 1048576.0 << " MiB, framebuffer " << r.framebufferBytes / 1048576.0 << " MiB, depth " << r.stats.maxDepth << std::endl;
+            std::cout << "  Mrays/s: primary " << r.primaryMrays << ", shadow " << r.shadowMrays << " (" << r.shadowRays << " rays), secondary "
+                      << r.secondaryMrays << " (" << r.secondaryRays << " rays)" << std::endl;
+            for (const ThreadResult &t : r.scaling) {
+                std::cout << "  threads=" << t.threads << ": build " << t.buildMs << " ms (" << r.scaling[0].buildMs / t.buildMs << "x), frame "
+                          << t.frameMs << " ms (" << r.scaling[0].frameMs / t.frameMs << "x), " << t.mrays << " Mrays/s" << std::endl;
+            }
+            print_sorting(r.sort);
+            results.push_back(r);
+        }
+    }
+
+    std::ofstream json(jsonPath);
+    write_json(json, results, width, height);
+    if (!json) {
+        std::cerr << "Failed to write " << jsonPath << std::endl;
+        return 1;
+    }
+    std::cout << "results written to " << jsonPath << " (commit " << GIT_COMMIT << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "scene.h"
+#include "mesh.h"
+#include "timeline.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+void default_scene(std::vector<Sphere> &spheres) {
+    spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.2), 0, 0.0));
+    spheres.push_back(Sphere(Vec3f(0.0, 0, -20), 4, Vec3f(1.00, 0.32, 0.36), 1, 0.5)); 
+    spheres.push_back(Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0));
+    spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
+    spheres.push_back(Sphere(Vec3f(-5.5, 0, -15), 3, Vec3f(0.90, 0.90, 0.90), 1, 0.0));
+    // 光源
+    spheres.push_back(Sphere(Vec3f(0.0, 20, -30), 3, Vec3f(0), 0, 0.0, Vec3f(1)));
+}
+
+void animate_scene(const std::vector<Sphere> &rest, float t, std::vector<Sphere> &spheres) {
+    for (size_t i = 0; i < rest.size() && i < spheres.size(); ++i) {
+        const Sphere &s = rest[i];
+        Vec3f c = s.center;
+        if (s.radius >= 1000) {
+            // 地面
+        } else if (s.emissionColor.x > 0) {
+            c.x += 10 * std::cos(0.5f * t + i);
+            c.z += 10 * std::sin(0.5f * t + i);
+        } else {
+            // 弹跳高度为半径，各球体相位错开
+            c.y += s.radius * std::abs(std::sin(2 * t + 0.7f * i));
+        }
+        spheres[i].center = c;
+    }
+}
+
+// 读取下一条有效行(跳过空行与注释)
+static bool next_line(std::ifstream &in, std::istringstream &line, int &lineNo) {
+    std::string text;
+    while (std::getline(in, text)) {
+        ++lineNo;
+        size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string::npos || text[start] == '#') continue;
+        line.clear();
+        line.str(text);
+        return true;
+    }
+    return false;
+}
+
+bool load_scene(const char *path, std::vector<Sphere> &spheres, TriangleMesh *mesh, InstanceSet *instances) {
+    TimelineScope scope("load scene", "io");
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open scene: " << path << std::endl;
+        return false;
+    }
+    std::istringstream line;
+    int lineNo = 0;
+    std::string dir(path);
+    dir = dir.substr(0, dir.find_last_of('/') + 1);
+    Prototype *object = nullptr; // 正在定义的原型，其中的球体与网格位于物体空间
+    while (next_line(in, line, lineNo)) {
+        std::string type, file;
+        Vec3f center, color, emission;
+        float radius, reflectivity = 0, transparency = 0;
+        line >> type;
+        if (type == "object" || type == "instance") {
+            if (!instances) {
+                std::cerr << path << ":" << lineNo << ": instances are not supported here" << std::endl;
+                return false;
+            }
+            std::string name;
+            line >> name;
+            std::vector<Prototype> &prototypes = instances->prototypes;
+            auto found = std::find_if(prototypes.begin(), prototypes.end(), [&](const Prototype &p) { return p.name == name; });
+            if (type == "object") {
+                if (!line || object || found != prototypes.end()) {
+                    std::cerr << path << ":" << lineNo << ": expected 'object name [levels]' with a new name outside other objects" << std::endl;
+                    return false;
+                }
+                prototypes.emplace_back();
+                object = &prototypes.back();
+                object->name = name;
+                unsigned levels = 0;
+                if (line >> levels) object->lods.resize(levels);
+                continue;
+            }
+            float scale = 1, yaw = 0;
+            line >> center.x >> center.y >> center.z;
+            if (!line || object || found == prototypes.end()) {
+                std::cerr << path << ":" << lineNo << ": expected 'instance name tx ty tz [scale yaw]' after the object is defined" << std::endl;
+                return false;
+            }
+            if (line >> scale) line >> yaw;
+            instances->instances.push_back(Instance{uint32_t(found - prototypes.begin()), Transform::place(center, scale, yaw)});
+            continue;
+        }
+        if (type == "end") {
+            if (!object) {
+                std::cerr << path << ":" << lineNo << ": 'end' without 'object'" << std::endl;
+                return false;
+            }
+            object = nullptr;
+            continue;
+        }
+        if (type == "mesh") line >> file;
+        line >> center.x >> center.y >> center.z >> radius >> color.x >> color.y >> color.z;
+        if ((type != "sphere" && type != "mesh") || !line) {
+            std::cerr << path << ":" << lineNo << ": expected 'sphere cx cy cz radius r g b' or 'mesh file.obj tx ty tz scale r g b'" << std::endl;
+            return false;
+        }
+        // 可选的材质参数
+        if (line >> reflectivity >> transparency) {
+            line >> emission.x >> emission.y >> emission.z;
+        }
+        if (type == "sphere") {
+            (object ? object->spheres : spheres).push_back(Sphere(center, radius, color, reflectivity, transparency, emission));
+            continue;
+        }
+        if (!object && !mesh) {
+            std::cerr << path << ":" << lineNo << ": meshes are not supported here" << std::endl;
+            return false;
+        }
+        if (file[0] != '/') file = dir + file;
+        if (!load_obj_mesh(file, center, radius, Material{color, emission, transparency, reflectivity}, object ? object->mesh : *mesh,
+                           object ? &object->lods : nullptr)) return false;
+    }
+    if (object) {
+        std::cerr << path << ": object '" << object->name << "' is missing 'end'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_camera_path(const char *path, std::vector<CameraPose> &poses) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open camera path: " << path << std::endl;
+        return false;
+    }
+    std::istringstream line;
+    int lineNo = 0;
+    while (next_line(in, line, lineNo)) {
+        CameraPose pose;
+        line >> pose.pos.x >> pose.pos.y >> pose.pos.z >> pose.target.x >> pose.target.y >> pose.target.z >> pose.fov;
+        if (!line) {
+            std::cerr << path << ":" << lineNo << ": expected 'px py pz tx ty tz fov'" << std::endl;
+            return false;
+        }
+        poses.push_back(pose);
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#include "timeline.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "thread_pool.h"
+
+std::atomic<bool> g_timelineEnabled{false};
+
+struct TimelineEvent {
+    const char *name;
+    const char *category;
+    const char *argName;
+    int64_t arg;
+    int64_t begin, end;
+};
+
+// 一个线程的事件缓冲区；tid 按首次记录的顺序分配
+struct TimelineThread {
+    unsigned tid;
+    std::string name;
+    std::vector<TimelineEvent> events;
+};
+
+static std::mutex g_timelineMutex; // 只保护线程列表，注册新线程与导出时使用
+static std::vector<std::unique_ptr<TimelineThread>> g_timelineThreads; // 线程退出后缓冲区仍然保留
+static thread_local TimelineThread *t_timelineThread = nullptr;
+static int64_t g_timelineOrigin = 0;
+
+int64_t timeline_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void timeline_start() {
+    std::lock_guard<std::mutex> lock(g_timelineMutex);
+    for (auto &t : g_timelineThreads) t->events.clear();
+    g_timelineOrigin = timeline_now();
+    g_timelineEnabled.store(true, std::memory_order_relaxed);
+}
+
+void timeline_record(const char *name, const char *category, const char *argName, int64_t arg, int64_t beginNs, int64_t endNs) {
+    TimelineThread *thread = t_timelineThread;
+    if (!thread) {
+        // 线程池外的调用线程(0 号)记为 main，其余按池中的编号命名
+        std::lock_guard<std::mutex> lock(g_timelineMutex);
+        thread = new TimelineThread();
+        thread->tid = unsigned(g_timelineThreads.size()) + 1;
+        unsigned worker = WorkStealingPool::currentWorker();
+        thread->name = worker == 0 ? "main" : "worker " + std::to_string(worker);
+        g_timelineThreads.emplace_back(thread);
+        t_timelineThread = thread;
+    }
+    thread->events.push_back(TimelineEvent{name, category, argName, arg, beginNs, endNs});
+}
+
+bool timeline_stop(const char *filename) {
+    g_timelineEnabled.store(false, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(g_timelineMutex);
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        std::cerr << "Failed to save: " << filename << std::endl;
+        return false;
+    }
+
+    // 时间戳与持续时间以微秒为单位，相对于 timeline_start
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"raytracer\"}}");
+    size_t count = 0;
+    for (const auto &t : g_timelineThreads) {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", t->tid, t->name.c_str());
+        for (const TimelineEvent &e : t->events) {
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    e.name, e.category, t->tid, (e.begin - g_timelineOrigin) * 1e-3, (e.end - e.begin) * 1e-3);
+            if (e.argName) fprintf(file, ",\"args\":{\"%s\":%lld}", e.argName, (long long)e.arg);
+            fprintf(file, "}");
+        }
+        count += t->events.size();
+        t->events.clear();
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (ok) std::cout << "Timeline: " << filename << " (" << count << " events)" << std::endl;
+    else std::cerr << "Failed to save: " << filename << std::endl;
+    return ok;
+}
@@ -1,18 +1,78 @@
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
 #include "trace.h"
 #include "kd_tree.h"
+#include "packet.h"
+#include "thread_pool.h"
+#include "timeline.h"
+#include "wavefront.h"
+#include "wide_tree.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 
-extern KDNode* g_kdRoot;
+extern LinearKDTree g_kdTree;
+
+// 由 g_kdTree 折叠出的宽树，g_wideWidth 为 0 时不使用
+static WideKDTree<4> g_wideTree4;
+static WideKDTree<8> g_wideTree8;
+static unsigned g_wideWidth = 0;
+
+size_t use_wide_tree(unsigned width) {
+    g_wideWidth = (width == 4 || width == 8) ? width : 0;
+    g_wideTree4 = WideKDTree<4>();
+    g_wideTree8 = WideKDTree<8>();
+    if (g_wideWidth == 4) build_wide_tree(g_kdTree, g_wideTree4);
+    else if (g_wideWidth == 8) build_wide_tree(g_kdTree, g_wideTree8);
+    return g_wideTree4.memoryBytes() + g_wideTree8.memoryBytes();
+}
+
+PrimHit intersect_scene(const Vec3f &rayorig, const Vec3f &raydir, float &tnear) {
+    if (g_wideWidth == 4) return intersect_wide_tree(g_wideTree4, rayorig, raydir, tnear);
+    if (g_wideWidth == 8) return intersect_wide_tree(g_wideTree8, rayorig, raydir, tnear);
+    return intersect_kd_tree(g_kdTree, rayorig, raydir, tnear);
+}
+
+bool occluded_scene(const Vec3f &rayorig, const Vec3f &raydir, float tmax, int32_t skipObject) {
+    if (g_wideWidth == 4) return occluded_wide_tree(g_wideTree4, rayorig, raydir, tmax, skipObject);
+    if (g_wideWidth == 8) return occluded_wide_tree(g_wideTree8, rayorig, raydir, tmax, skipObject);
+    return occluded_kd_tree(g_kdTree, rayorig, raydir, tmax, skipObject);
+}
+
+// 光线计数：线程内累加，每个分块结束时汇总到全局计数
+static std::atomic<uint64_t> g_rayCount{0};
+static thread_local uint64_t t_rayCount = 0;
+
+uint64_t ray_count() {
+    return g_rayCount.load();
+}
+
+void reset_ray_count() {
+    g_rayCount = 0;
+}
+
+void add_ray_count(uint64_t n) {
+    g_rayCount.fetch_add(n, std::memory_order_relaxed);
+}
 
 float mix(const float &a, const float &b, const float &mix) {
     return b * mix + a * (1 - mix);
 }
 
 
-Vec3f trace(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere> &spheres, const int &depth) {
+// 时间线只记录每 TIMELINE_TRACE_STRIDE 个像素中一个像素的完整递归(按深度嵌套的 trace 事件)，
+// 逐条光线记录的计时开销与事件数都过大
+#define TIMELINE_TRACE_STRIDE 64
+static thread_local bool t_timelineTrace = false;
+static thread_local unsigned t_timelinePixels = 0;
+
+static void sample_timeline_pixel() {
+    t_timelineTrace = timeline_enabled() && ++t_timelinePixels % TIMELINE_TRACE_STRIDE == 0;
+}
+
+Vec3f trace(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere> &spheres, const int &depth, const LightSampler &sampler) {
+    TimelineScope scope(t_timelineTrace ? "trace" : nullptr, "trace", "depth", depth);
     float tnear = INFINITY; // 最近相交点距离
+    ++t_rayCount;
     // const Sphere* sphere = nullptr; // 最近相交球体
 
     // // 遍历所有球体寻找最近交点
@@ -26,15 +86,20 @@ Vec3f trace(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere>
     //         }
     //     }
     // }
-    const Sphere* sphere = intersect_kd_tree(g_kdRoot, rayorig, raydir, tnear);
+    PrimHit hit = intersect_scene(rayorig, raydir, tnear);
 
     // 如果没有撞上任何物体，返回背景颜色 白色
-    if (!sphere) return Vec3f(2); 
+    if (!hit) return Vec3f(2); 
 
-    // 计算交点 P 和该点的法线 N
+    return shade(rayorig, raydir, hit, tnear, spheres, depth, sampler);
+}
+
+Vec3f shade(const Vec3f &rayorig, const Vec3f &raydir, const PrimHit &hit, float tnear, const std::vector<Sphere> &spheres, int depth, const LightSampler &sampler) {
+    // 计算交点 P 和该点的法线 N(三角形为插值的顶点法线)，以及交点处的材质
     Vec3f phit = rayorig + raydir * tnear; // 交点坐标
-    Vec3f nhit = phit - sphere->center;    // 计算法线
-    nhit.normalize();                      // 归一化法线
+    Vec3f nhit;
+    Material material;
+    hit_surface(g_kdTree, hit, phit, nhit, material);
     
     // 处理反射和折射
     Vec3f surfaceColor = 0;
@@ -43,7 +108,7 @@ Vec3f trace(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere>
     if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true; // 处理光线从内部射出的情况
 
     // 反射/透明物体：计算表面颜色
-    if ((sphere->transparency > 0 || sphere->reflectivity > 0) && depth < MAX_RAY_DEPTH) {
+    if ((material.transparency > 0 || material.reflectivity > 0) && depth < MAX_RAY_DEPTH) {
         float facingratio = -raydir.dot(nhit);
         // 菲涅耳公式的简化近似：角度越偏，反射越强
         float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
@@ -51,116 +116,634 @@ Vec3f trace(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere>
         // 计算反射方向
         Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
         refldir.normalize();
-        Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
+        RAY_STAT(secondary, 1);
+        Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1, sampler.reflected());
 
         // 计算折射方向
         Vec3f refraction = 0;
-        if (sphere->transparency > 0) {
+        if (material.transparency > 0) {
             float ior = 1.1, eta = (inside) ? ior : 1 / ior; // 折射率
             float cos_i = -nhit.dot(raydir);
             float k = 1 - eta * eta * (1 - cos_i * cos_i);
             Vec3f refrdir = raydir * eta + nhit * (eta * cos_i - sqrt(k));
             refrdir.normalize();
-            refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
+            RAY_STAT(secondary, 1);
+            refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1, sampler.refracted());
         }
 
         // 综合颜色结果
-        surfaceColor = (reflection * fresneleffect + refraction * (1 - fresneleffect) * sphere->transparency) * sphere->surfaceColor;
+        surfaceColor = (reflection * fresneleffect + refraction * (1 - fresneleffect) * material.transparency) * material.surfaceColor;
     }
     // 漫反射物体/达到最大深度 终止跟踪，计算阴影
     else {
         // 计算漫反射颜色
-        for (unsigned i = 0; i < spheres.size(); ++i) {
-            if (spheres[i].emissionColor.x > 0) {
-                // 光源
-                Vec3f transmission = 1;
-                Vec3f lightVec = spheres[i].center - phit;
-                float dToLight = lightVec.length();
-                Vec3f lightDirection = lightVec / dToLight;
-
-                // // 阴影射线：检查交点与光源之间是否有遮挡
-                // for (unsigned j = 0; j < spheres.size(); ++j) {
-                //     if (i != j) {
-                //         float t0, t1;
-                //         if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
-                //             transmission = 0; // 被遮挡，进入阴影
-                //             break;
-                //         }
-                //     }
-                // }
-
-                float tShadow = dToLight; // 初始距离设为到光源的距离
-                const Sphere* shadowObj = intersect_kd_tree(g_kdRoot, phit + nhit * bias, lightDirection, tShadow);
-                // 如果在到光源的距离(dToLight)内碰到了非光源物体，则是阴影
-                if (shadowObj && shadowObj != &spheres[i]) {
-                    transmission = 0;
-                }
-                // 漫反射计算：颜色 * 强度 * 夹角余弦
-                surfaceColor += sphere->surfaceColor * transmission * std::max(0.0f, nhit.dot(lightDirection)) * spheres[i].emissionColor;
+        // 光源直接取自构建时收集的光源列表；光源数超过 lightSamples 时按功率随机选取，
+        // 贡献除以选中概率与采样数，期望与逐个计算全部光源相同
+        const std::vector<uint32_t>& emitters = g_kdTree.emitters;
+        bool sampled = sampler.lightSamples > 0 && sampler.lightSamples < emitters.size();
+        size_t count = sampled ? sampler.lightSamples : emitters.size();
+        uint32_t rng = sampler.seed();
+        for (size_t k = 0; k < count; ++k) {
+            float weight = 1;
+            size_t e = k;
+            if (sampled) {
+                float pdf;
+                e = g_kdTree.sampleEmitter(next_random(rng), pdf);
+                weight = 1 / (pdf * count);
+            }
+            const Sphere& light = spheres[emitters[e]];
+            Vec3f transmission = 1;
+            Vec3f lightVec = light.center - phit;
+            float dToLight = lightVec.length();
+            Vec3f lightDirection = lightVec / dToLight;
+
+            // // 阴影射线：检查交点与光源之间是否有遮挡
+            // for (unsigned j = 0; j < spheres.size(); ++j) {
+            //     if (i != j) {
+            //         float t0, t1;
+            //         if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+            //             transmission = 0; // 被遮挡，进入阴影
+            //             break;
+            //         }
+            //     }
+            // }
+
+            // 阴影射线：到光源的距离(dToLight)内只要碰到任何非光源物体就是阴影，找到第一个遮挡物即可停止
+            ++t_rayCount;
+            RAY_STAT(secondary, 1);
+            if (occluded_scene(phit + nhit * bias, lightDirection, dToLight, int32_t(emitters[e]))) {
+                transmission = 0;
             }
+            // 漫反射计算：颜色 * 强度 * 夹角余弦
+            surfaceColor += material.surfaceColor * transmission * std::max(0.0f, nhit.dot(lightDirection)) * light.emissionColor * weight;
         }
     }
 
-    return surfaceColor + sphere->emissionColor;
+    return surfaceColor + material.emissionColor;
+}
+
+// 渲染线程池：线程数变化时重建，避免每帧创建/销毁线程
+WorkStealingPool& render_pool(unsigned threads) {
+    static std::unique_ptr<WorkStealingPool> pool;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    if (!pool || pool->size() != threads) {
+        pool.reset();
+        pool.reset(new WorkStealingPool(threads));
+    }
+    return *pool;
 }
 
-void renderToBuffer(const std::vector<Sphere> &spheres, const Vec3f &camPos, const Vec3f &camTarget, float fov, Vec3f* buffer) {
-    float invWidth = 1 / float(640), invHeight = 1 / float(480);
-    float aspectratio = 640 / float(480);
-    float angle = tan(M_PI * 0.5 * fov / 180.);
+// 相机坐标系：由相机位置、目标点、FOV 与画面尺寸生成每个像素的主光线
+struct CameraFrame {
+    Vec3f u, v, w;
+    float invWidth, invHeight, aspectratio, angle;
 
-    // 计算相机基向量 u, v, w
-    Vec3f vup(0, 1, 0);
-    Vec3f w = (camPos - camTarget); w.normalize();
-    
-    // 自定义叉乘逻辑
-    auto cross = [](const Vec3f &a, const Vec3f &b) {
-        return Vec3f(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
-    };
-    
-    Vec3f u = cross(vup, w); u.normalize();
-    Vec3f v = cross(w, u);
-
-    for (unsigned y = 0; y < 480; ++y) {
-        for (unsigned x = 0; x < 640; ++x) {
-            float xx = (2 * ((x + 0.5) * invWidth) - 1) * angle * aspectratio;
-            float yy = (1 - 2 * ((y + 0.5) * invHeight)) * angle;
-            
-            Vec3f raydir = u * xx + v * yy - w;
-            raydir.normalize();
-            
-            // OpenGL 的像素起点在左下角，需要进行 y 轴翻转映射
-            buffer[(480 - 1 - y) * 640 + x] = trace(camPos, raydir, spheres, 0);
+    CameraFrame(const Vec3f &camPos, const Vec3f &camTarget, float fov, const RenderSettings &settings) {
+        invWidth = 1 / float(settings.width), invHeight = 1 / float(settings.height);
+        aspectratio = settings.aspect > 0 ? settings.aspect : settings.width / float(settings.height);
+        angle = tan(M_PI * 0.5 * fov / 180.);
+
+        // 计算相机基向量 u, v, w
+        Vec3f vup(0, 1, 0);
+        w = (camPos - camTarget); w.normalize();
+        
+        // 自定义叉乘逻辑
+        auto cross = [](const Vec3f &a, const Vec3f &b) {
+            return Vec3f(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+        };
+        
+        u = cross(vup, w); u.normalize();
+        v = cross(w, u);
+    }
+
+    // 图像坐标 (x, y) 处像素中心的光线方向，y 自上而下
+    Vec3f primaryRay(unsigned x, unsigned y) const {
+        return primaryRayAt(x + 0.5, y + 0.5);
+    }
+
+    // 连续图像坐标 (px, py) 处的光线方向，像素 (x, y) 覆盖 [x, x+1) x [y, y+1)
+    Vec3f primaryRayAt(double px, double py) const {
+        float xx = (2 * (px * invWidth) - 1) * angle * aspectratio;
+        float yy = (1 - 2 * (py * invHeight)) * angle;
+        Vec3f raydir = u * xx + v * yy - w;
+        raydir.normalize();
+        return raydir;
+    }
+
+    // primaryRay 的逆映射：视线方向 d 投影到图像坐标(像素中心为整数)，d 指向相机背后时返回 false
+    bool project(const Vec3f &d, float &x, float &y) const {
+        float z = -d.dot(w);
+        if (z <= 0) return false;
+        float xx = d.dot(u) / z, yy = d.dot(v) / z;
+        x = (xx / (angle * aspectratio) + 1) * 0.5f / invWidth - 0.5f;
+        y = (1 - yy / angle) * 0.5f / invHeight - 0.5f;
+        return true;
+    }
+
+    // 射线 o + d t (o 相对于相机)进入视锥(四个侧面围成的棱锥)的参数 tEnter，射线始终不进入视锥时返回 false
+    bool frustumEntry(const Vec3f &o, const Vec3f &d, float &tEnter) const {
+        float ax = angle * aspectratio, ay = angle;
+        // 每个侧面：f(t) = f0 + f1 t >= 0 表示在内侧
+        float f0[4] = {ax * -o.dot(w) - o.dot(u), ax * -o.dot(w) + o.dot(u), ay * -o.dot(w) - o.dot(v), ay * -o.dot(w) + o.dot(v)};
+        float f1[4] = {ax * -d.dot(w) - d.dot(u), ax * -d.dot(w) + d.dot(u), ay * -d.dot(w) - d.dot(v), ay * -d.dot(w) + d.dot(v)};
+        tEnter = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (f0[k] >= 0) continue;
+            if (f1[k] <= 0) return false;
+            tEnter = std::max(tEnter, -f0[k] / f1[k]);
         }
+        return true;
     }
+};
+
+// 将矩形区域 [0, width) x [y0, y1) 切分为 tileSize x tileSize 的分块，由线程池通过工作窃取调度
+// 每个像素的计算互相独立，因此结果与串行渲染逐像素一致
+template<typename TileFn>
+static void render_tiles(unsigned width, unsigned y0, unsigned y1, const RenderSettings &settings, const TileFn &tileFn) {
+    unsigned tileSize = std::max(1u, settings.tileSize);
+    unsigned tilesX = (width + tileSize - 1) / tileSize;
+    unsigned tilesY = (y1 - y0 + tileSize - 1) / tileSize;
+
+    render_pool(settings.threads).parallel_for(tilesX * tilesY, [&](size_t tile, unsigned) {
+        TimelineScope scope("tile", "render", "tile", tile);
+        unsigned tx0 = (tile % tilesX) * tileSize, ty0 = y0 + (tile / tilesX) * tileSize;
+        unsigned tx1 = std::min(tx0 + tileSize, width), ty1 = std::min(ty0 + tileSize, y1);
+        uint64_t raysBefore = t_rayCount;
+        tileFn(tx0, ty0, tx1, ty1);
+        t_timelineTrace = false;
+        g_rayCount.fetch_add(t_rayCount - raysBefore, std::memory_order_relaxed);
+    });
 }
 
-void save_frame(Vec3f* image, unsigned width, unsigned height, const char *outdir) {
-    static int save_num = 0; // 已保存的图片数
+#ifdef RAY_STATS
+// 当前帧的逐像素统计，由渲染入口按 settings.stats 设置
+static FrameStats *g_frameStats = nullptr;
+#endif
 
-    // 构建文件名
-    char filename[256];
-    std::snprintf(filename, sizeof(filename), "%s/frame_%d.png", outdir, save_num++);
+// 作用域内当前线程累计的遍历统计记到像素 (x, y)(y 自上而下)；未以 RAY_STATS 编译时为空对象
+struct PixelStatsScope {
+#ifdef RAY_STATS
+    unsigned x, y;
+    RayStats before;
+    PixelStatsScope(unsigned x, unsigned y) : x(x), y(y), before(t_rayStats) {}
+    ~PixelStatsScope() {
+        if (g_frameStats) g_frameStats->pixels[size_t(y) * g_frameStats->width + x] += t_rayStats - before;
+    }
+#else
+    PixelStatsScope(unsigned, unsigned) {}
+#endif
+};
+
+static void begin_frame_stats(const RenderSettings &settings) {
+#ifdef RAY_STATS
+    g_frameStats = settings.stats;
+    if (!g_frameStats) return;
+    g_frameStats->width = settings.width, g_frameStats->height = settings.height;
+    g_frameStats->pixels.assign(size_t(settings.width) * settings.height, RayStats());
+#else
+    (void)settings;
+#endif
+}
+
+static void end_frame_stats() {
+#ifdef RAY_STATS
+    if (!g_frameStats) return;
+    g_frameStats->totals = RayStats();
+    for (const RayStats &p : g_frameStats->pixels) g_frameStats->totals += p;
+    g_frameStats = nullptr;
+#endif
+}
+
+// 主光线：与 trace 相同，同时给出命中物体的编号(hit_object，-1 表示未命中)与交点距离
+static Vec3f trace_primary(const Vec3f &camPos, const Vec3f &raydir, const std::vector<Sphere> &spheres, const LightSampler &sampler,
+                           int32_t &object, float &tnear) {
+    sample_timeline_pixel();
+    TimelineScope scope(t_timelineTrace ? "trace" : nullptr, "trace", "depth", 0);
+    tnear = INFINITY;
+    ++t_rayCount;
+    PrimHit hit = intersect_scene(camPos, raydir, tnear);
+    object = hit_object(g_kdTree, hit);
+    if (!hit) return Vec3f(2);
+    return shade(camPos, raydir, hit, tnear, spheres, 0, sampler);
+}
+
+// 渲染分块 [x0, x1) x [y0, y1) 的主光线，store(x, y, color, object) 写出结果与命中物体的编号
+// 开启光线包时，SSE 以 2x2、AVX 以 4x2 个相邻像素组成一个包共同遍历加速树，
+// 包内光线方向不一致时退回逐条跟踪；命中之后的着色与次级光线仍逐条计算
+template<typename StoreFn>
+static void render_primary_tile(const CameraFrame &cam, const Vec3f &camPos, const std::vector<Sphere> &spheres, const RenderSettings &settings,
+                                unsigned packetWidth, unsigned x0, unsigned y0, unsigned x1, unsigned y1, const StoreFn &store) {
+    auto sampler = [&](unsigned x, unsigned y) { return LightSampler(settings.lightSamples, y * settings.width + x); };
+    int32_t object;
+    float tnear;
+    if (packetWidth <= 1) {
+        for (unsigned y = y0; y < y1; ++y) {
+            for (unsigned x = x0; x < x1; ++x) {
+                PixelStatsScope pixelStats(x, y);
+                Vec3f color = trace_primary(camPos, cam.primaryRay(x, y), spheres, sampler(x, y), object, tnear);
+                store(x, y, color, object);
+            }
+        }
+        return;
+    }
+
+    unsigned pw = packetWidth == 8 ? 4 : 2, ph = 2;
+    for (unsigned y = y0; y < y1; y += ph) {
+        for (unsigned x = x0; x < x1; x += pw) {
+            RayPacket packet;
+            packet.orig = camPos;
+            Vec3f dirs[MAX_PACKET_SIZE];
+            for (unsigned k = 0; k < packetWidth; ++k) {
+                unsigned px = x + k % pw, py = y + k / pw;
+                // 分块边缘不足一个包时，空余通道复制第 0 条光线并标记为无效
+                if (px < x1 && py < y1) {
+                    dirs[k] = cam.primaryRay(px, py);
+                    packet.active |= 1u << k;
+                } else {
+                    dirs[k] = dirs[0];
+                }
+                packet.dx[k] = dirs[k].x, packet.dy[k] = dirs[k].y, packet.dz[k] = dirs[k].z;
+                packet.tnear[k] = INFINITY;
+                packet.hit[k] = -1;
+            }
+
+            bool coherent = intersect_packet(g_kdTree, packet, packetWidth);
+            for (unsigned k = 0; k < packetWidth; ++k) {
+                if (!(packet.active & (1u << k))) continue;
+                unsigned px = x + k % pw, py = y + k / pw;
+                if (!coherent) {
+                    Vec3f color = trace_primary(camPos, dirs[k], spheres, sampler(px, py), object, tnear);
+                    store(px, py, color, object);
+                    continue;
+                }
+                sample_timeline_pixel();
+                TimelineScope scope(t_timelineTrace ? "trace" : nullptr, "trace", "depth", 0);
+                ++t_rayCount;
+                if (packet.hit[k] < 0) store(px, py, Vec3f(2), -1);
+                else store(px, py, shade(camPos, dirs[k], object_hit(g_kdTree, packet.hit[k]), packet.tnear[k], spheres, 0, sampler(px, py)), packet.hit[k]);
+            }
+        }
+    }
+}
+
+// 自适应反走样使用的一次采样结果，覆盖第 [y0, y1) 行：待渲染的行及其上下各一行邻域
+// 逐个行带渲染时在带之间保留，下一个行带复用与上一带重叠的两行
+struct SampleRows {
+    unsigned y0 = 0, y1 = 0;
+    std::vector<Vec3f> color;
+    std::vector<int32_t> object;
+};
+
+// 渲染图像的第 [y0, y1) 行，store(x, y, color) 写出结果
+// 开启自适应反走样(aaSamples > 0)时分两遍：第一遍每像素一条主光线，并记录命中物体；
+// 第二遍找出与上下左右相邻像素命中物体不同或颜色差超过 aaThreshold 的边缘像素，
+// 在像素内按 n x n 分层抖动追加子采样(n = floor(sqrt(aaSamples)))，与中心采样一起取平均
+template<typename StoreFn>
+static void render_rows(const CameraFrame &cam, const Vec3f &camPos, const std::vector<Sphere> &spheres, const RenderSettings &settings,
+                        unsigned y0, unsigned y1, SampleRows &samples, const StoreFn &store) {
+    unsigned width = settings.width, height = settings.height;
+    unsigned packetWidth = supported_packet_width(settings.packetWidth);
+#ifdef RAY_STATS
+    if (g_frameStats) packetWidth = 1; // 光线包的遍历不计数，统计时逐条跟踪
+#endif
+    // 波前引擎每像素只有一条主光线，也不按像素记录统计：开启反走样或统计时退回逐像素 trace
+    if (settings.wavefront && settings.aaSamples == 0 && !settings.stats) {
+        std::vector<Vec3f> dirs(size_t(width) * (y1 - y0));
+        for (unsigned y = y0; y < y1; ++y) {
+            for (unsigned x = 0; x < width; ++x) dirs[size_t(y - y0) * width + x] = cam.primaryRay(x, y);
+        }
+        samples.color.resize(dirs.size());
+        trace_wavefront(camPos, dirs, y0 * width, spheres, samples.color.data(), settings);
+        for (unsigned y = y0; y < y1; ++y) {
+            for (unsigned x = 0; x < width; ++x) store(x, y, samples.color[size_t(y - y0) * width + x]);
+        }
+        return;
+    }
+    if (settings.aaSamples == 0) {
+        render_tiles(width, y0, y1, settings, [&](unsigned x0, unsigned ty0, unsigned x1, unsigned ty1) {
+            render_primary_tile(cam, camPos, spheres, settings, packetWidth, x0, ty0, x1, ty1, [&](unsigned x, unsigned y, const Vec3f &color, int32_t) {
+                store(x, y, color);
+            });
+        });
+        return;
+    }
+
+    // 上一次调用已采样的行(紧接着的上一个行带的最后一行与本带第一行)直接移到缓冲区开头，只渲染其余的行，
+    // 每行只跟踪一次，遍历统计也只记录一次
+    unsigned sy0 = y0 > 0 ? y0 - 1 : 0, sy1 = std::min(y1 + 1, height);
+    unsigned keep = sy0;
+    if (samples.y0 <= sy0 && sy0 < samples.y1) {
+        keep = std::min(samples.y1, sy1);
+        size_t from = size_t(sy0 - samples.y0) * width, count = size_t(keep - sy0) * width;
+        std::copy(samples.color.begin() + from, samples.color.begin() + from + count, samples.color.begin());
+        std::copy(samples.object.begin() + from, samples.object.begin() + from + count, samples.object.begin());
+    }
+    samples.y0 = sy0, samples.y1 = sy1;
+    samples.color.resize(size_t(width) * (sy1 - sy0));
+    samples.object.resize(size_t(width) * (sy1 - sy0));
+    render_tiles(width, keep, sy1, settings, [&](unsigned x0, unsigned ty0, unsigned x1, unsigned ty1) {
+        render_primary_tile(cam, camPos, spheres, settings, packetWidth, x0, ty0, x1, ty1, [&](unsigned x, unsigned y, const Vec3f &color, int32_t object) {
+            size_t i = size_t(y - sy0) * width + x;
+            samples.color[i] = color;
+            samples.object[i] = object;
+        });
+    });
+
+    unsigned n = std::max(1u, (unsigned)std::sqrt((float)settings.aaSamples));
+    render_tiles(width, y0, y1, settings, [&](unsigned x0, unsigned ty0, unsigned x1, unsigned ty1) {
+        for (unsigned y = ty0; y < ty1; ++y) {
+            for (unsigned x = x0; x < x1; ++x) {
+                size_t i = size_t(y - sy0) * width + x;
+                const Vec3f &c = samples.color[i];
+                bool edge = false;
+                auto visit = [&](size_t j) {
+                    const Vec3f &d = samples.color[j];
+                    edge = edge || samples.object[j] != samples.object[i]
+                        || std::abs(std::min(1.0f, c.x) - std::min(1.0f, d.x)) > settings.aaThreshold
+                        || std::abs(std::min(1.0f, c.y) - std::min(1.0f, d.y)) > settings.aaThreshold
+                        || std::abs(std::min(1.0f, c.z) - std::min(1.0f, d.z)) > settings.aaThreshold;
+                };
+                if (x > 0) visit(i - 1);
+                if (x + 1 < width) visit(i + 1);
+                if (y > 0) visit(i - width);
+                if (y + 1 < height) visit(i + width);
+                if (!edge) {
+                    store(x, y, c);
+                    continue;
+                }
+                PixelStatsScope pixelStats(x, y);
+                Vec3f sum = c;
+                uint32_t pixel = y * width + x;
+                uint32_t jitter = sample_seed(pixel, 0, 0); // 路径编号 0 不对应任何光线
+                for (unsigned sy = 0; sy < n; ++sy) {
+                    for (unsigned sx = 0; sx < n; ++sx) {
+                        double px = x + (sx + next_random(jitter)) / n, py = y + (sy + next_random(jitter)) / n;
+                        sum += trace(camPos, cam.primaryRayAt(px, py), spheres, 0, LightSampler(settings.lightSamples, pixel, sy * n + sx + 1));
+                    }
+                }
+                store(x, y, sum * (1.0f / (n * n + 1)));
+            }
+        }
+    });
+}
+
+// 按本帧的相机与分辨率为每个实例选择细节层次，在渲染开始前完成；返回是否有实例切换了层次
+static bool select_levels(const CameraFrame &cam, const RenderSettings &settings, const Vec3f &camPos) {
+    return select_instance_levels(g_kdTree, camPos, cam.angle, settings.height, settings.lodPixels);
+}
+
+void renderToBuffer(const std::vector<Sphere> &spheres, const Vec3f &camPos, const Vec3f &camTarget, float fov, Vec3f* buffer, const RenderSettings &settings) {
+    TimelineScope scope("render frame", "render");
+    CameraFrame cam(camPos, camTarget, fov, settings);
+    select_levels(cam, settings, camPos);
+    unsigned width = settings.width, height = settings.height;
+    SampleRows samples;
+
+    begin_frame_stats(settings);
+    render_rows(cam, camPos, spheres, settings, 0, height, samples, [&](unsigned x, unsigned y, const Vec3f &color) {
+        // OpenGL 的像素起点在左下角，需要进行 y 轴翻转映射
+        buffer[(height - 1 - y) * width + x] = color;
+    });
+    end_frame_stats();
+}
 
-    // 将 Vec3f (float) 转换为 PNG 格式需要的 R8G8B8 (unsigned char)
-    std::vector<unsigned char> pixels(width * height * 3);
+// 重投影分三步：
+// 1. 前向投影：上一帧的每个命中点投影到新相机，取最近的点写入对应像素(深度测试)，没有点落入的像素是空洞。
+//    未命中的像素不参与投影：背景光线不需要着色，重新跟踪的代价与验证相当，而无穷远处的点在平移时不动，
+//    会填进本应是空洞的去遮挡区域
+// 2. 判定：空洞、与相邻像素命中物体不同的边缘像素、视角相关材质、
+//    新光线在进入上一帧视锥之前被遮挡(相机移动后从画面外露出的物体)，以及
+//    亚像素偏移 x 邻域最大颜色差超过阈值的像素需要重新跟踪
+// 3. 重新跟踪被标记的像素，其余像素直接沿用投影得到的颜色
+// 漫反射着色与视角无关，因此复用的颜色就是该命中点的精确颜色，误差只来自命中点与像素中心的偏移
+void renderReprojected(const std::vector<Sphere> &spheres, const Vec3f &camPos, const Vec3f &camTarget, float fov, Vec3f* buffer, const RenderSettings &settings, FrameCache &cache) {
+    TimelineScope scope("render reprojected", "render");
+    CameraFrame cam(camPos, camTarget, fov, settings);
+    unsigned width = settings.width, height = settings.height;
+    size_t pixels = size_t(width) * height;
+    bool levelsChanged = select_levels(cam, settings, camPos);
+    bool reuse = cache.width == width && cache.height == height;
+    CameraFrame prevCam(cache.camPos, cache.camTarget, cache.fov, settings);
+
+    cache.nextPoint.resize(pixels);
+    cache.nextColor.resize(pixels);
+    cache.nextObject.assign(pixels, -2); // -2 表示空洞
+    cache.depth.assign(pixels, INFINITY);
+    cache.offset.assign(pixels, 0);
+    cache.retrace.assign(pixels, 1);
+    begin_frame_stats(settings);
+
+    if (reuse) {
+        TimelineScope reproject("reproject", "render");
+        for (size_t i = 0; i < pixels; ++i) {
+            int32_t obj = cache.object[i];
+            if (obj < 0) continue;
+            Vec3f d = cache.point[i] - camPos;
+            float x, y;
+            if (!cam.project(d, x, y)) continue;
+            float px = std::floor(x + 0.5f), py = std::floor(y + 0.5f);
+            if (px < 0 || py < 0 || px >= width || py >= height) continue;
+            size_t j = size_t(py) * width + size_t(px);
+            float z = -d.dot(cam.w);
+            if (cache.nextObject[j] != -2 && z >= cache.depth[j]) continue;
+            cache.depth[j] = z;
+            cache.offset[j] = std::sqrt((x - px) * (x - px) + (y - py) * (y - py));
+            cache.nextObject[j] = obj;
+            cache.nextPoint[j] = cache.point[i];
+            cache.nextColor[j] = cache.color[i];
+        }
+
+        render_tiles(width, 0, height, settings, [&](unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+            for (unsigned y = y0; y < y1; ++y) {
+                for (unsigned x = x0; x < x1; ++x) {
+                    size_t i = size_t(y) * width + x;
+                    int32_t obj = cache.nextObject[i];
+                    if (obj == -2) continue;
+                    PixelStatsScope pixelStats(x, y);
+                    if (!settings.reprojectViewDependent && object_view_dependent(g_kdTree, obj)) continue;
+                    // 切换了细节层次的实例形状已经变化，它覆盖的像素重新跟踪，轮廓附近由边缘判定处理
+                    if (levelsChanged && object_level_changed(g_kdTree, obj)) continue;
+
+                    // 光线在上一帧视锥内的部分已被看到过，视锥外的部分可能有未见过的物体挡在命中点前面，
+                    // 用一条 any-hit 遮挡光线检查这一段，代价远小于重新着色
+                    Vec3f raydir = cam.primaryRay(x, y);
+                    float tEnter;
+                    if (!prevCam.frustumEntry(camPos - cache.camPos, raydir, tEnter)) continue;
+                    if (tEnter > 0) {
+                        tEnter = std::min(tEnter, (cache.nextPoint[i] - camPos).length());
+                        ++t_rayCount;
+                        if (occluded_scene(camPos, raydir, tEnter, obj)) continue;
+                    }
+
+                    bool edge = false;
+                    float maxDiff = 0;
+                    auto visit = [&](size_t n) {
+                        if (cache.nextObject[n] != obj) { edge = true; return; }
+                        const Vec3f &a = cache.nextColor[i], &b = cache.nextColor[n];
+                        maxDiff = std::max(maxDiff, std::abs(std::min(1.0f, a.x) - std::min(1.0f, b.x)));
+                        maxDiff = std::max(maxDiff, std::abs(std::min(1.0f, a.y) - std::min(1.0f, b.y)));
+                        maxDiff = std::max(maxDiff, std::abs(std::min(1.0f, a.z) - std::min(1.0f, b.z)));
+                    };
+                    if (x > 0) visit(i - 1);
+                    if (x + 1 < width) visit(i + 1);
+                    if (y > 0) visit(i - width);
+                    if (y + 1 < height) visit(i + width);
+                    if (!edge && cache.offset[i] * maxDiff <= settings.reprojectThreshold) cache.retrace[i] = 0;
+                }
+            }
+        });
+    }
+
+    std::atomic<size_t> retraced{0};
+    render_tiles(width, 0, height, settings, [&](unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+        size_t count = 0;
+        for (unsigned y = y0; y < y1; ++y) {
+            for (unsigned x = x0; x < x1; ++x) {
+                size_t i = size_t(y) * width + x;
+                if (!cache.retrace[i]) continue;
+                ++count;
+                PixelStatsScope pixelStats(x, y);
+                Vec3f raydir = cam.primaryRay(x, y);
+                float tnear;
+                cache.nextColor[i] = trace_primary(camPos, raydir, spheres, LightSampler(settings.lightSamples, uint32_t(i)), cache.nextObject[i], tnear);
+                cache.nextPoint[i] = cache.nextObject[i] >= 0 ? camPos + raydir * tnear : raydir;
+            }
+        }
+        retraced.fetch_add(count, std::memory_order_relaxed);
+    });
+
+    // OpenGL 的像素起点在左下角，需要进行 y 轴翻转映射
     for (unsigned y = 0; y < height; ++y) {
-        for (unsigned x = 0; x < width; ++x) {
-            // 从 image 缓冲区中反向读取 y 轴
-            // imageBuffer 的 (height-1-y) 行对应 PNG 的第 y 行
-            unsigned int src_idx = (height - 1 - y) * width + x;
-            unsigned int dst_idx = (y * width + x) * 3;
-            pixels[dst_idx + 0] = (unsigned char)(std::max(0.0f, std::min(1.0f, image[src_idx].x)) * 255);
-            pixels[dst_idx + 1] = (unsigned char)(std::max(0.0f, std::min(1.0f, image[src_idx].y)) * 255);
-            pixels[dst_idx + 2] = (unsigned char)(std::max(0.0f, std::min(1.0f, image[src_idx].z)) * 255);
+        std::copy(&cache.nextColor[size_t(y) * width], &cache.nextColor[size_t(y) * width] + width,
+                  buffer + size_t(height - 1 - y) * width);
+    }
+    cache.point.swap(cache.nextPoint);
+    cache.color.swap(cache.nextColor);
+    cache.object.swap(cache.nextObject);
+    cache.width = width, cache.height = height;
+    cache.camPos = camPos, cache.camTarget = camTarget, cache.fov = fov;
+    cache.retraced = retraced;
+    end_frame_stats();
+}
+
+bool renderToSink(const std::vector<Sphere> &spheres, const Vec3f &camPos, const Vec3f &camTarget, float fov, ImageSink &sink, const RenderSettings &settings) {
+    TimelineScope scope("render streamed", "render");
+    CameraFrame cam(camPos, camTarget, fov, settings);
+    select_levels(cam, settings, camPos);
+    unsigned width = settings.width, height = settings.height;
+    unsigned bandHeight = std::max(1u, settings.tileSize);
+    SampleRows samples;
+
+    // 只分配一个行带的缓冲区，渲染完一带立即交给 sink
+    // 开启反走样时 samples 在行带之间保留，每带只需额外渲染下方的一行作为邻域
+    std::vector<Vec3f> band(size_t(width) * bandHeight);
+    if (!sink.begin(width, height)) return false;
+    for (unsigned y0 = 0; y0 < height; y0 += bandHeight) {
+        unsigned y1 = std::min(y0 + bandHeight, height);
+        render_rows(cam, camPos, spheres, settings, y0, y1, samples, [&](unsigned x, unsigned y, const Vec3f &color) {
+            band[size_t(y - y0) * width + x] = color;
+        });
+        if (!sink.writeBand(y0, y1 - y0, band.data())) return false;
+    }
+    return sink.end();
+}
+
+void report_thread_scaling(const std::vector<Sphere> &spheres, const Vec3f &camPos, const Vec3f &camTarget, float fov, unsigned maxThreads, const RenderSettings &settings) {
+    const size_t pixels = size_t(settings.width) * settings.height;
+    if (maxThreads == 0) maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Vec3f> reference(pixels), image(pixels);
+
+    // 计时函数：取多次渲染中的最短时间，减少抖动
+    auto timeRender = [&](unsigned threads, Vec3f* out) {
+        RenderSettings config = settings;
+        config.threads = threads;
+        renderToBuffer(spheres, camPos, camTarget, fov, out, config); // 预热(创建线程池)
+        double best = INFINITY;
+        for (int i = 0; i < 3; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            renderToBuffer(spheres, camPos, camTarget, fov, out, config);
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+            best = std::min(best, ms.count());
         }
+        return best;
+    };
+
+    unsigned tileSize = settings.tileSize;
+    double serial = timeRender(1, reference.data());
+    std::cout << "tile=" << tileSize << " threads=1 time=" << serial << "ms speedup=1.00x" << std::endl;
+    for (unsigned t = 2; t <= maxThreads; ++t) {
+        double ms = timeRender(t, image.data());
+        bool match = std::memcmp(reference.data(), image.data(), pixels * sizeof(Vec3f)) == 0;
+        std::cout << "tile=" << tileSize << " threads=" << t << " time=" << ms << "ms speedup="
+                  << serial / ms << "x match=" << (match ? "yes" : "NO") << std::endl;
     }
-    // 写入 PNG 文件
-    // 参数：文件名, 宽, 高, 通道数(3为RGB), 数据指针, 每行字节数
-    int success = stbi_write_png(filename, width, height, 3, pixels.data(), width * 3);
+}
+
+// 生成下一个输出文件名 outdir/frame_{save_num}.png
+static void next_frame_filename(const char *outdir, char *filename, size_t size) {
+    static int save_num = 0; // 已保存的图片数
+    std::snprintf(filename, size, "%s/frame_%d.png", outdir, save_num++);
+}
+
+static void report_saved(const char *filename, bool success) {
     if (success) {
         std::cout << "Saved: " << filename << std::endl;
     } else {
         std::cerr << "Failed to save: " << filename << std::endl;
     }
-}
\ No newline at end of file
+}
+
+void save_frame(Vec3f* image, unsigned width, unsigned height, const char *outdir) {
+    // 构建文件名
+    char filename[256];
+    next_frame_filename(outdir, filename, sizeof(filename));
+    report_saved(filename, save_buffer_png(image, width, height, filename));
+}
+
+bool save_buffer_png(const Vec3f* image, unsigned width, unsigned height, const char *filename) {
+    TimelineScope scope("save png", "io");
+    // 从 image 缓冲区中反向读取 y 轴：imageBuffer 的 (height-1-y) 行对应 PNG 的第 y 行
+    // 每次翻转一个行带交给编码器
+    const unsigned bandHeight = 32;
+    std::vector<Vec3f> band(size_t(width) * bandHeight);
+    PngStreamWriter writer(filename);
+    bool success = writer.begin(width, height);
+    for (unsigned y0 = 0; success && y0 < height; y0 += bandHeight) {
+        unsigned rows = std::min(bandHeight, height - y0);
+        for (unsigned y = 0; y < rows; ++y) {
+            const Vec3f* src = image + size_t(height - 1 - (y0 + y)) * width;
+            std::copy(src, src + width, band.begin() + size_t(y) * width);
+        }
+        success = writer.writeBand(y0, rows, band.data());
+    }
+    return success && writer.end();
+}
+
+bool save_stats_heatmap(const FrameStats &stats, uint64_t RayStats::*field, const char *filename) {
+    unsigned width = stats.width, height = stats.height;
+    uint64_t maxCount = 1;
+    for (const RayStats &p : stats.pixels) maxCount = std::max(maxCount, p.*field);
+
+    // 遍历开销通常呈长尾分布，用 log(1 + n) / log(1 + max) 归一化，低开销区域的差别仍然可见
+    static const Vec3f ramp[] = {Vec3f(0, 0, 0), Vec3f(0, 0, 1), Vec3f(0, 1, 1), Vec3f(0, 1, 0), Vec3f(1, 1, 0), Vec3f(1, 0, 0)};
+    const int stops = sizeof(ramp) / sizeof(ramp[0]) - 1;
+    float scale = 1 / std::log1p(float(maxCount));
+    std::vector<Vec3f> image(size_t(width) * height);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            float s = std::log1p(float(stats.pixels[size_t(y) * width + x].*field)) * scale * stops;
+            int k = std::min(int(s), stops - 1);
+            float f = s - k;
+            // save_buffer_png 按 OpenGL 顺序(自下而上)读取
+            image[size_t(height - 1 - y) * width + x] = ramp[k] * (1 - f) + ramp[k + 1] * f;
+        }
+    }
+    return save_buffer_png(image.data(), width, height, filename);
+}
+
+void save_frame_streamed(const std::vector<Sphere> &spheres, const Vec3f &camPos, const Vec3f &camTarget, float fov, const RenderSettings &settings, const char *outdir) {
+    char filename[256];
+    next_frame_filename(outdir, filename, sizeof(filename));
+    PngStreamWriter writer(filename);
+    report_saved(filename, renderToSink(spheres, camPos, camTarget, fov, writer, settings));
+}
@@ -0,0 +1,360 @@
+#include "wavefront.h"
+#include "kd_tree.h"
+#include "thread_pool.h"
+#include "timeline.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <utility>
+
+extern LinearKDTree g_kdTree;
+
+// 每个并行任务处理的光线数
+#define WAVEFRONT_CHUNK 4096
+
+// SoA 光线队列：每条光线带有所属像素、路径编号(见 LightSampler)与路径吞吐量，extend 阶段写入最近交点
+struct RayQueue {
+    std::vector<float> ox, oy, oz, dx, dy, dz;
+    std::vector<float> wx, wy, wz;     // 路径吞吐量：该光线带回的辐射度乘以它即为对像素的贡献
+    std::vector<uint32_t> pixel;
+    std::vector<uint8_t> path;         // 深度不超过 MAX_RAY_DEPTH，路径编号小于 2^(MAX_RAY_DEPTH + 1)
+    std::vector<float> t;              // 最近交点距离
+    std::vector<int32_t> hit;          // 命中物体的编号(hit_object)，-1 表示未命中
+    std::vector<int32_t> prim;         // 命中实例时图元在原型底层树中的编号(hit_primitive)
+    std::vector<float> u, v;           // 命中三角形时的重心坐标
+
+    size_t size() const { return pixel.size(); }
+    Vec3f origin(size_t i) const { return Vec3f(ox[i], oy[i], oz[i]); }
+    Vec3f direction(size_t i) const { return Vec3f(dx[i], dy[i], dz[i]); }
+    Vec3f weight(size_t i) const { return Vec3f(wx[i], wy[i], wz[i]); }
+
+    void clear() {
+        ox.clear(), oy.clear(), oz.clear(), dx.clear(), dy.clear(), dz.clear();
+        wx.clear(), wy.clear(), wz.clear(), pixel.clear(), path.clear();
+    }
+
+    void push(const Vec3f &o, const Vec3f &d, const Vec3f &w, uint32_t p, uint32_t pathId) {
+        ox.push_back(o.x), oy.push_back(o.y), oz.push_back(o.z);
+        dx.push_back(d.x), dy.push_back(d.y), dz.push_back(d.z);
+        wx.push_back(w.x), wy.push_back(w.y), wz.push_back(w.z);
+        pixel.push_back(p);
+        path.push_back(uint8_t(pathId));
+    }
+
+    void append(const RayQueue &q) {
+        auto cat = [](std::vector<float> &a, const std::vector<float> &b) { a.insert(a.end(), b.begin(), b.end()); };
+        cat(ox, q.ox), cat(oy, q.oy), cat(oz, q.oz), cat(dx, q.dx), cat(dy, q.dy), cat(dz, q.dz);
+        cat(wx, q.wx), cat(wy, q.wy), cat(wz, q.wz);
+        pixel.insert(pixel.end(), q.pixel.begin(), q.pixel.end());
+        path.insert(path.end(), q.path.begin(), q.path.end());
+    }
+};
+
+// SoA 阴影光线队列：未被遮挡时把 contribution 累加到像素
+struct ShadowQueue {
+    std::vector<float> ox, oy, oz, dx, dy, dz, tmax;
+    std::vector<uint32_t> light;       // 光源在 spheres 中的下标(也是它的物体编号)，遮挡查询时跳过它
+    std::vector<float> cx, cy, cz;     // 对像素的贡献
+    std::vector<uint32_t> pixel;
+    std::vector<uint8_t> visible;      // shadow 阶段写入
+
+    size_t size() const { return pixel.size(); }
+
+    void clear() {
+        ox.clear(), oy.clear(), oz.clear(), dx.clear(), dy.clear(), dz.clear(), tmax.clear();
+        light.clear(), cx.clear(), cy.clear(), cz.clear(), pixel.clear();
+    }
+
+    void push(const Vec3f &o, const Vec3f &d, float t, uint32_t l, const Vec3f &c, uint32_t p) {
+        ox.push_back(o.x), oy.push_back(o.y), oz.push_back(o.z);
+        dx.push_back(d.x), dy.push_back(d.y), dz.push_back(d.z);
+        tmax.push_back(t), light.push_back(l);
+        cx.push_back(c.x), cy.push_back(c.y), cz.push_back(c.z);
+        pixel.push_back(p);
+    }
+
+    void append(const ShadowQueue &q) {
+        auto cat = [](auto &a, const auto &b) { a.insert(a.end(), b.begin(), b.end()); };
+        cat(ox, q.ox), cat(oy, q.oy), cat(oz, q.oz), cat(dx, q.dx), cat(dy, q.dy), cat(dz, q.dz), cat(tmax, q.tmax);
+        cat(light, q.light), cat(cx, q.cx), cat(cy, q.cy), cat(cz, q.cz), cat(pixel, q.pixel);
+    }
+};
+
+// shade 阶段每个任务的输出，合并时按任务顺序拼接，结果与线程调度无关
+struct ShadeOutput {
+    RayQueue rays;
+    ShadowQueue shadows;
+    std::vector<std::pair<uint32_t, Vec3f>> radiance; // (像素, 贡献)：背景与自发光
+};
+
+// 光线排序键：高 2 位以外依次为方向卦限(3 位)与起点的 Morton 码(每轴 9 位，按场景包围盒归一化)
+// 起点相近且方向大致相同的光线排在一起，遍历时访问的节点与叶子也相近
+static uint32_t expand_bits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000FFu;
+    v = (v | (v << 8)) & 0x0300F00Fu;
+    v = (v | (v << 4)) & 0x030C30C3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+static uint32_t ray_sort_key(const AABB &bounds, const Vec3f &o, const Vec3f &d) {
+    auto quantize = [](float v, float lo, float hi) {
+        float t = hi > lo ? (v - lo) / (hi - lo) : 0;
+        return (uint32_t)std::min(511.0f, std::max(0.0f, t * 512));
+    };
+    uint32_t morton = (expand_bits(quantize(o.x, bounds.min.x, bounds.max.x)) << 2)
+                    | (expand_bits(quantize(o.y, bounds.min.y, bounds.max.y)) << 1)
+                    | expand_bits(quantize(o.z, bounds.min.z, bounds.max.z));
+    uint32_t octant = (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+    return (octant << 27) | morton;
+}
+
+// 按键值基数排序(每趟 8 位，稳定)，输出排序后的下标
+static void radix_sort_order(std::vector<uint32_t> &keys, std::vector<uint32_t> &order) {
+    size_t n = keys.size();
+    std::vector<uint32_t> tmpKeys(n), tmpOrder(n);
+    order.resize(n);
+    for (size_t i = 0; i < n; ++i) order[i] = (uint32_t)i;
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t count[257] = {0};
+        for (size_t i = 0; i < n; ++i) ++count[((keys[i] >> shift) & 0xFF) + 1];
+        if (count[1] == n) continue; // 这一趟所有键相同
+        for (int b = 0; b < 256; ++b) count[b + 1] += count[b];
+        for (size_t i = 0; i < n; ++i) {
+            size_t dst = count[(keys[i] >> shift) & 0xFF]++;
+            tmpKeys[dst] = keys[i];
+            tmpOrder[dst] = order[i];
+        }
+        keys.swap(tmpKeys);
+        order.swap(tmpOrder);
+    }
+}
+
+template<typename T>
+static void gather(std::vector<T> &v, const std::vector<uint32_t> &order) {
+    std::vector<T> out(order.size());
+    for (size_t i = 0; i < order.size(); ++i) out[i] = v[order[i]];
+    v.swap(out);
+}
+
+// 按排序键重排光线队列(只重排 SoA 输入，extend 的输出随后重新计算)
+static void sort_rays(RayQueue &q, const AABB &bounds) {
+    std::vector<uint32_t> keys(q.size()), order;
+    for (size_t i = 0; i < q.size(); ++i) keys[i] = ray_sort_key(bounds, q.origin(i), q.direction(i));
+    radix_sort_order(keys, order);
+    gather(q.ox, order), gather(q.oy, order), gather(q.oz, order);
+    gather(q.dx, order), gather(q.dy, order), gather(q.dz, order);
+    gather(q.wx, order), gather(q.wy, order), gather(q.wz, order);
+    gather(q.pixel, order), gather(q.path, order);
+}
+
+static void sort_shadows(ShadowQueue &q, const AABB &bounds) {
+    std::vector<uint32_t> keys(q.size()), order;
+    for (size_t i = 0; i < q.size(); ++i) {
+        keys[i] = ray_sort_key(bounds, Vec3f(q.ox[i], q.oy[i], q.oz[i]), Vec3f(q.dx[i], q.dy[i], q.dz[i]));
+    }
+    radix_sort_order(keys, order);
+    gather(q.ox, order), gather(q.oy, order), gather(q.oz, order);
+    gather(q.dx, order), gather(q.dy, order), gather(q.dz, order), gather(q.tmax, order);
+    gather(q.light, order), gather(q.cx, order), gather(q.cy, order), gather(q.cz, order);
+    gather(q.pixel, order);
+}
+
+static size_t chunk_count(size_t n) {
+    return (n + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+}
+
+// 各任务的遍历统计(RAY_STATS)合并到 total，total 为空时不统计
+class StageStats {
+public:
+    explicit StageStats(RayStats *total) : total(total) {}
+#ifdef RAY_STATS
+    RayStats begin() const { return t_rayStats; }
+    void end(const RayStats &before) {
+        if (!total) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        *total += t_rayStats - before;
+    }
+#else
+    RayStats begin() const { return RayStats(); }
+    void end(const RayStats &) {}
+#endif
+
+private:
+    RayStats *total;
+    std::mutex mutex;
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// extend：整个队列的最近交点查询
+static void extend_stage(WorkStealingPool &pool, RayQueue &q, StageStats &stats) {
+    q.t.resize(q.size());
+    q.hit.resize(q.size());
+    q.prim.resize(q.size());
+    q.u.resize(q.size());
+    q.v.resize(q.size());
+    pool.parallel_for(chunk_count(q.size()), [&](size_t c, unsigned) {
+        RayStats before = stats.begin();
+        size_t end = std::min(q.size(), (c + 1) * WAVEFRONT_CHUNK);
+        for (size_t i = c * WAVEFRONT_CHUNK; i < end; ++i) {
+            float tnear = INFINITY;
+            PrimHit hit = intersect_scene(q.origin(i), q.direction(i), tnear);
+            q.t[i] = tnear;
+            q.hit[i] = hit_object(g_kdTree, hit);
+            q.prim[i] = hit_primitive(g_kdTree, hit);
+            q.u[i] = hit.u, q.v[i] = hit.v;
+        }
+        stats.end(before);
+    });
+    add_ray_count(q.size());
+}
+
+// shade：与 shade() 的分支一一对应，递归调用 trace 的地方改为向下一深度的队列追加光线
+// 光源采样的随机数与 trace 一样由像素编号(firstPixel + 队列中的像素下标)与路径编号播种
+static void shade_ray(const RayQueue &q, size_t i, int depth, const std::vector<Sphere> &spheres, unsigned lightSamples,
+                      uint32_t firstPixel, ShadeOutput &out) {
+    Vec3f w = q.weight(i);
+    uint32_t pixel = q.pixel[i];
+    if (q.hit[i] < 0) {
+        out.radiance.emplace_back(pixel, w * Vec3f(2));
+        return;
+    }
+    Vec3f rayorig = q.origin(i), raydir = q.direction(i);
+    Vec3f phit = rayorig + raydir * q.t[i];
+    Vec3f nhit;
+    Material material;
+    hit_surface(g_kdTree, object_hit(g_kdTree, q.hit[i], q.u[i], q.v[i], q.prim[i]), phit, nhit, material);
+
+    float bias = 1e-4;
+    bool inside = false;
+    if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
+
+    const Vec3f &e = material.emissionColor;
+    if (e.x != 0 || e.y != 0 || e.z != 0) out.radiance.emplace_back(pixel, w * e);
+
+    if ((material.transparency > 0 || material.reflectivity > 0) && depth < MAX_RAY_DEPTH) {
+        float facingratio = -raydir.dot(nhit);
+        float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
+
+        Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
+        refldir.normalize();
+        out.rays.push(phit + nhit * bias, refldir, w * material.surfaceColor * fresneleffect, pixel, q.path[i] * 2u);
+
+        if (material.transparency > 0) {
+            float ior = 1.1, eta = (inside) ? ior : 1 / ior;
+            float cos_i = -nhit.dot(raydir);
+            float k = 1 - eta * eta * (1 - cos_i * cos_i);
+            Vec3f refrdir = raydir * eta + nhit * (eta * cos_i - sqrt(k));
+            refrdir.normalize();
+            out.rays.push(phit - nhit * bias, refrdir, w * material.surfaceColor * ((1 - fresneleffect) * material.transparency), pixel, q.path[i] * 2u + 1);
+        }
+        return;
+    }
+
+    // 漫反射：与 shade() 相同的光源列表与按功率采样
+    const std::vector<uint32_t> &emitters = g_kdTree.emitters;
+    bool sampled = lightSamples > 0 && lightSamples < emitters.size();
+    size_t count = sampled ? lightSamples : emitters.size();
+    LightSampler sampler(lightSamples, firstPixel + pixel, 0, q.path[i]);
+    uint32_t rng = sampler.seed();
+    for (size_t k = 0; k < count; ++k) {
+        float weight = 1;
+        size_t l = k;
+        if (sampled) {
+            float pdf;
+            l = g_kdTree.sampleEmitter(next_random(rng), pdf);
+            weight = 1 / (pdf * count);
+        }
+        const Sphere &light = spheres[emitters[l]];
+        Vec3f lightVec = light.center - phit;
+        float dToLight = lightVec.length();
+        Vec3f lightDirection = lightVec / dToLight;
+        float cosine = nhit.dot(lightDirection);
+        if (cosine <= 0) continue; // 背光时贡献为 0，不必发射阴影光线
+        Vec3f contribution = w * (material.surfaceColor * cosine * light.emissionColor * weight);
+        out.shadows.push(phit + nhit * bias, lightDirection, dToLight, emitters[l], contribution, pixel);
+    }
+}
+
+// shadow：整个阴影队列的遮挡查询
+static void shadow_stage(WorkStealingPool &pool, ShadowQueue &q, StageStats &stats) {
+    q.visible.resize(q.size());
+    pool.parallel_for(chunk_count(q.size()), [&](size_t c, unsigned) {
+        RayStats before = stats.begin();
+        size_t end = std::min(q.size(), (c + 1) * WAVEFRONT_CHUNK);
+        for (size_t i = c * WAVEFRONT_CHUNK; i < end; ++i) {
+            Vec3f o(q.ox[i], q.oy[i], q.oz[i]), d(q.dx[i], q.dy[i], q.dz[i]);
+            q.visible[i] = !occluded_scene(o, d, q.tmax[i], int32_t(q.light[i]));
+        }
+        stats.end(before);
+    });
+    add_ray_count(q.size());
+}
+
+void trace_wavefront(const Vec3f &orig, const std::vector<Vec3f> &dirs, uint32_t firstPixel, const std::vector<Sphere> &spheres, Vec3f *colors,
+                     const RenderSettings &settings) {
+    WorkStealingPool &pool = render_pool(settings.threads);
+    RayQueue rays, next;
+    ShadowQueue shadows;
+    std::vector<ShadeOutput> outputs;
+    WavefrontStats *report = settings.wavefrontStats;
+    StageStats primaryStats(nullptr), secondaryStats(report ? &report->secondary : nullptr), shadowStats(report ? &report->shadow : nullptr);
+
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        colors[i] = Vec3f(0);
+        rays.push(orig, dirs[i], Vec3f(1), (uint32_t)i, 1);
+    }
+
+    // 主光线按像素顺序生成，本身已经相干；次级光线与阴影光线在遍历前按排序键重排
+    const AABB bounds = g_kdTree.nodes.empty() ? AABB() : g_kdTree.nodes[0].bbox;
+    for (int depth = 0; rays.size() > 0; ++depth) {
+        // 波前的每一轮对应 trace 的一层递归
+        TimelineScope scope("wavefront depth", "trace", "depth", depth);
+        auto start = std::chrono::steady_clock::now();
+        if (depth > 0 && settings.sortRays) sort_rays(rays, bounds);
+        if (report && depth > 0) report->sortMs += elapsed_ms(start), start = std::chrono::steady_clock::now();
+        {
+            TimelineScope extend("extend", "trace", "rays", rays.size());
+            extend_stage(pool, rays, depth > 0 ? secondaryStats : primaryStats);
+        }
+        if (report && depth > 0) report->secondaryMs += elapsed_ms(start), report->secondaryRays += rays.size();
+
+        size_t chunks = chunk_count(rays.size());
+        outputs.resize(std::max(outputs.size(), chunks));
+        pool.parallel_for(chunks, [&](size_t c, unsigned) {
+            TimelineScope shade("shade", "trace", "chunk", c);
+            ShadeOutput &out = outputs[c];
+            out.rays.clear();
+            out.shadows.clear();
+            out.radiance.clear();
+            size_t end = std::min(rays.size(), (c + 1) * WAVEFRONT_CHUNK);
+            for (size_t i = c * WAVEFRONT_CHUNK; i < end; ++i) shade_ray(rays, i, depth, spheres, settings.lightSamples, firstPixel, out);
+        });
+
+        // 按任务顺序合并：累加背景与自发光，拼接下一深度的光线与阴影光线
+        next.clear();
+        shadows.clear();
+        for (size_t c = 0; c < chunks; ++c) {
+            for (const auto &r : outputs[c].radiance) colors[r.first] += r.second;
+            next.append(outputs[c].rays);
+            shadows.append(outputs[c].shadows);
+        }
+
+        start = std::chrono::steady_clock::now();
+        if (settings.sortRays) sort_shadows(shadows, bounds);
+        if (report) report->sortMs += elapsed_ms(start), start = std::chrono::steady_clock::now();
+        {
+            TimelineScope shadow("shadow", "trace", "rays", shadows.size());
+            shadow_stage(pool, shadows, shadowStats);
+        }
+        if (report) report->shadowMs += elapsed_ms(start), report->shadowRays += shadows.size();
+        for (size_t i = 0; i < shadows.size(); ++i) {
+            if (shadows.visible[i]) colors[shadows.pixel[i]] += Vec3f(shadows.cx[i], shadows.cy[i], shadows.cz[i]);
+        }
+
+        std::swap(rays, next);
+    }
+}
@@ -0,0 +1,22 @@
+// 宽树 8 路节点的 AVX 遍历内核，本文件单独以 -mavx 编译，只能在 supported_packet_width(8) == 8 时调用
+#include "wide_tree.h"
+
+#if defined(__AVX__)
+#include "simd_avx.h"
+#include "wide_kernel.h"
+
+void wide_intersect8_avx(const WideKDNode<8>* nodes, WideQuery& query) {
+    wide_traverse_nearest<SimdAVX, 8>(nodes, query);
+}
+
+bool wide_occluded8_avx(const WideKDNode<8>* nodes, WideQuery& query) {
+    return wide_traverse_occluded<SimdAVX, 8>(nodes, query);
+}
+#else
+// 未以 AVX 编译时 supported_packet_width 不会返回 8，以下函数不会被调用
+void wide_intersect8_avx(const WideKDNode<8>*, WideQuery&) {}
+
+bool wide_occluded8_avx(const WideKDNode<8>*, WideQuery&) {
+    return false;
+}
+#endif
@@ -0,0 +1,73 @@
+// 宽树(BVH4 / BVH8)遍历：SSE 版本的内核、叶子求交，以及 8 路节点按 CPU 支持情况选择 AVX 内核的分发逻辑
+#include "wide_tree.h"
+#include "packet.h"
+
+#if defined(__SSE2__)
+#include "simd_sse.h"
+typedef SimdSSE WideSimd;
+#else
+namespace {
+// 没有 SSE 时逐个子节点测试；max/min 的 NaN 处理与 SSE 相同(有 NaN 时返回第二个操作数)
+struct SimdScalar {
+    typedef float F;
+    static const int N = 1;
+    static F zero() { return 0; }
+    static F set1(float v) { return v; }
+    static F load(const float* p) { return *p; }
+    static void store(float* p, F v) { *p = v; }
+    static F sub(F a, F b) { return a - b; }
+    static F mul(F a, F b) { return a * b; }
+    static F min(F a, F b) { return a < b ? a : b; }
+    static F max(F a, F b) { return a > b ? a : b; }
+    static F cmple(F a, F b) { return a <= b ? 1.0f : 0.0f; }
+    static int movemask(F a) { return a != 0; }
+};
+} // namespace
+typedef SimdScalar WideSimd;
+#endif
+#include "wide_kernel.h"
+
+void wide_leaf_intersect(WideQuery& q, uint32_t offset, uint32_t count, uint8_t type) {
+    RAY_STAT(leaves, 1);
+    intersect_leaf(*q.tree, offset, count, type, q.orig, q.dir, q.wray, q.tmax, q.nearest);
+}
+
+bool wide_leaf_occluded(WideQuery& q, uint32_t offset, uint32_t count, uint8_t type) {
+    RAY_STAT(leaves, 1);
+    return occluded_leaf(*q.tree, offset, count, type, q.orig, q.dir, q.wray, q.tmax, q.skipObject);
+}
+
+static bool wide_avx_supported() {
+    static const bool supported = supported_packet_width(8) == 8;
+    return supported;
+}
+
+PrimHit intersect_wide_tree(const WideKDTree<4>& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear) {
+    if (tree.nodes.empty()) return PrimHit();
+    WideQuery q(*tree.base, rayorig, raydir, tnear);
+    wide_traverse_nearest<WideSimd, 4>(tree.nodes.data(), q);
+    tnear = q.tmax;
+    return resolve_hit(*tree.base, q.nearest);
+}
+
+PrimHit intersect_wide_tree(const WideKDTree<8>& tree, const Vec3f& rayorig, const Vec3f& raydir, float& tnear) {
+    if (tree.nodes.empty()) return PrimHit();
+    WideQuery q(*tree.base, rayorig, raydir, tnear);
+    if (wide_avx_supported()) wide_intersect8_avx(tree.nodes.data(), q);
+    else wide_traverse_nearest<WideSimd, 8>(tree.nodes.data(), q);
+    tnear = q.tmax;
+    return resolve_hit(*tree.base, q.nearest);
+}
+
+bool occluded_wide_tree(const WideKDTree<4>& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject) {
+    if (tree.nodes.empty()) return false;
+    WideQuery q(*tree.base, rayorig, raydir, tmax, skipObject);
+    return wide_traverse_occluded<WideSimd, 4>(tree.nodes.data(), q);
+}
+
+bool occluded_wide_tree(const WideKDTree<8>& tree, const Vec3f& rayorig, const Vec3f& raydir, float tmax, int32_t skipObject) {
+    if (tree.nodes.empty()) return false;
+    WideQuery q(*tree.base, rayorig, raydir, tmax, skipObject);
+    if (wide_avx_supported()) return wide_occluded8_avx(tree.nodes.data(), q);
+    return wide_traverse_occluded<WideSimd, 8>(tree.nodes.data(), q);
+}